@@ -35,11 +35,27 @@ CONFIG_DEBUG ?= y
 # Requires libjit
 CONFIG_JIT ?= n
 
-# Three different backend choices, which control the display and audio.
+# if 'y', the ROM is mapped into a host region with mmap() so that it can be
+# read directly, rather then through the MMU
+#
+# Linux only - Requires memfd_create()
+CONFIG_FASTMEM ?= n
+
+# if 'y', the screen can be drawn on a separate thread, selected with
+# '--render-thread'
+#
+# Requires pthreads
+CONFIG_RENDER_THREAD ?= n
+
+# Four different backend choices, which control the display and audio.
 # This has to be chosen at compile time.
 #
 # The emscripten makes use of the sdl backend along with some extra settings
+#
+# The null backend displays nothing and has no audio, for running without a
+# display. It is also always available at runtime through '--headless'.
 CONFIG_BACKEND ?= SDL
 # CONFIG_BACKEND := PROTURA
 # CONFIG_BACKEND := EMSCRIPTEN
+# CONFIG_BACKEND := NULL
 
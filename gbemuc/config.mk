@@ -46,9 +46,18 @@ endif
 GBEMUC_CFLAGS += -DGBEMUC_BACKEND_$(REALBACKEND)
 
 ifeq ($(CONFIG_JIT),y)
-	GBEMUC_LIBFLAGS += -ljit
+	GBEMUC_LIBFLAGS += -ljit -lpthread
 	GBEMUC_CFLAGS += -DCONFIG_JIT
 endif
 
+ifeq ($(CONFIG_FASTMEM),y)
+	GBEMUC_CFLAGS += -DCONFIG_FASTMEM
+endif
+
+ifeq ($(CONFIG_RENDER_THREAD),y)
+	GBEMUC_LIBFLAGS += -lpthread
+	GBEMUC_CFLAGS += -DCONFIG_RENDER_THREAD
+endif
+
 GBEMUC_OBJS += ./gbemuc.o
 
@@ -0,0 +1,300 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gb.h"
+#include "gb/gpu.h"
+#include "gb/batch.h"
+
+/*
+ * Batch runs - See gb/batch.h.
+ *
+ * Every lane is a full gb_emu, so splitting one is the same kind of copy the
+ * JIT verifier makes of its shadow. Only the first lane owns the ROM and the
+ * fast memory mapping, the copies share the ROM data and read it through the
+ * MMU.
+ *
+ * The sound registers are disabled in every lane, since the APU can't be
+ * shared between them, and nothing is ever written to a .sav file. Lines
+ * are always drawn as they're reached, rather then on a render thread.
+ */
+
+static void batch_disp_buf(struct gb_gpu_display *display, void *buf, const uint32_t *dirty_lines)
+{
+    /* Nothing is displayed, the caller looks at the gb_emu directly */
+}
+
+static void batch_get_keystate(struct gb_emu *emu, struct gb_keypad *keys)
+{
+    struct gb_batch_lane *lane = container_of(emu, struct gb_batch_lane, emu);
+
+    *keys = lane->keys;
+}
+
+static int batch_new_lane(struct gb_batch *batch)
+{
+    struct gb_batch_lane *lane = malloc(sizeof(*lane));
+
+    memset(lane, 0, sizeof(*lane));
+    lane->display.disp_buf = batch_disp_buf;
+    lane->display.get_keystate = batch_get_keystate;
+    lane->parent = -1;
+
+    batch->lanes[batch->lane_count] = lane;
+    return batch->lane_count++;
+}
+
+/* Makes a copy of lane 'id' which runs with 'keys', and returns the new lane */
+static int batch_split(struct gb_batch *batch, int id, const struct gb_keypad *keys)
+{
+    struct gb_batch_lane *parent = batch->lanes[id], *lane;
+    int new_id = batch_new_lane(batch);
+
+    lane = batch->lanes[new_id];
+    lane->emu = parent->emu;
+    lane->display.dmg_theme = parent->display.dmg_theme;
+    lane->display.format = parent->display.format;
+    lane->keys = *keys;
+    lane->has_keys = 1;
+    lane->parent = id;
+
+    lane->emu.gpu.display = &lane->display;
+    lane->emu.cpu.hooks = NULL;
+    lane->emu.hook_flag = 0;
+    lane->emu.breakpoints = NULL;
+    lane->emu.breakpoint_count = 0;
+
+    /* The fetch pointer could point into the parent's WRAM */
+    gb_mmu_fetch_flush(&lane->emu.mmu);
+
+#ifdef CONFIG_FASTMEM
+    lane->emu.mmu.fastmem.base = NULL;
+    lane->emu.mmu.fastmem.rom_fd = -1;
+#endif
+
+#ifdef CONFIG_RENDER_THREAD
+    lane->emu.gpu.render_thread = NULL;
+#endif
+
+    DEBUG_PRINTF("Batch: Frame %d, lane %d split from lane %d\n", batch->frame, new_id, id);
+
+    return new_id;
+}
+
+int gb_batch_init(struct gb_batch *batch, const char *filename, const struct gb_config *config, int count)
+{
+    struct gb_batch_lane *lane;
+    struct gb_emu *emu;
+
+    if (count <= 0)
+        return 1;
+
+    memset(batch, 0, sizeof(*batch));
+    batch->count = count;
+    batch->filename = filename;
+    batch->config = *config;
+
+    /* Each instance can end up in its own lane, but no more */
+    batch->lanes = malloc(count * sizeof(*batch->lanes));
+    batch->lane_of = calloc(count, sizeof(*batch->lane_of));
+    batch->keys = calloc(count, sizeof(*batch->keys));
+
+    lane = batch->lanes[batch_new_lane(batch)];
+    emu = &lane->emu;
+
+    gb_emu_init(emu);
+    emu->config = *config;
+    emu->config.render_thread = 0;
+
+    gb_emu_rom_open(emu, filename);
+    if (!emu->rom.data) {
+        gb_batch_clear(batch);
+        return 1;
+    }
+
+    emu->rom.sav_filename = NULL;
+    emu->sound.disabled = 1;
+
+    gb_emu_set_display(emu, &lane->display);
+    gb_emu_reset(emu);
+
+    return 0;
+}
+
+void gb_batch_clear(struct gb_batch *batch)
+{
+    int i;
+
+    if (batch->lane_count)
+        gb_emu_clear(&batch->lanes[0]->emu);
+
+    for (i = 0; i < batch->lane_count; i++)
+        free(batch->lanes[i]);
+
+    free(batch->lanes);
+    free(batch->lane_of);
+    free(batch->keys);
+
+    memset(batch, 0, sizeof(*batch));
+}
+
+/* Draws the screen of every lane in 'format' from now on, lanes split off
+ * later keep it */
+void gb_batch_set_format(struct gb_batch *batch, enum gb_gpu_format format)
+{
+    int l;
+
+    for (l = 0; l < batch->lane_count; l++) {
+        batch->lanes[l]->display.format = format;
+        gb_gpu_set_format(&batch->lanes[l]->emu.gpu, format);
+    }
+}
+
+/* Gives each instance its input for this frame, splitting lanes as needed */
+static void batch_assign_lanes(struct gb_batch *batch)
+{
+    int first_new = batch->lane_count;
+    int i, l;
+
+    for (i = 0; i < batch->lane_count; i++) {
+        batch->lanes[i]->has_keys = 0;
+        batch->lanes[i]->parent = -1;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        int id = batch->lane_of[i];
+        struct gb_batch_lane *lane = batch->lanes[id];
+
+        (batch->get_input) (batch->data, i, batch->frame + 1, batch->keys + i);
+
+        if (!lane->has_keys) {
+            lane->keys = batch->keys[i];
+            lane->has_keys = 1;
+            continue;
+        }
+
+        if (memcmp(&lane->keys, batch->keys + i, sizeof(lane->keys)) == 0)
+            continue;
+
+        /* Another instance may have already split off with the same keys */
+        for (l = first_new; l < batch->lane_count; l++)
+            if (batch->lanes[l]->parent == id && memcmp(&batch->lanes[l]->keys, batch->keys + i, sizeof(batch->keys[i])) == 0)
+                break;
+
+        if (l == batch->lane_count)
+            l = batch_split(batch, id, batch->keys + i);
+
+        batch->lane_of[i] = l;
+    }
+}
+
+/* Runs every instance for one frame */
+void gb_batch_run_frame(struct gb_batch *batch)
+{
+    int l;
+
+    if (batch->get_input)
+        batch_assign_lanes(batch);
+
+    for (l = 0; l < batch->lane_count; l++) {
+        struct gb_emu *emu = &batch->lanes[l]->emu;
+
+        emu->gpu.frame_is_done = 0;
+        while (!emu->gpu.frame_is_done && !emu->stop_emu)
+            gb_emu_cpu_run_next_inst(emu);
+    }
+
+    batch->frame++;
+}
+
+/* Lets a batch of one run instance 'id' of another batch on its own */
+struct batch_verify_input {
+    struct gb_batch *batch;
+    int id;
+};
+
+static void batch_verify_get_input(void *data, int id, int frame, struct gb_keypad *keys)
+{
+    struct batch_verify_input *input = data;
+
+    (input->batch->get_input) (input->batch->data, input->id, frame, keys);
+}
+
+/* Returns the name of the first thing that differs between 'a' and 'b', or
+ * NULL if they match */
+static const char *batch_compare(struct gb_emu *a, struct gb_emu *b)
+{
+    size_t screen_len = (size_t)gb_gpu_format_line_bytes(a->gpu.format) * GB_SCREEN_HEIGHT;
+
+    if (memcmp(&a->cpu.r, &b->cpu.r, sizeof(a->cpu.r)) != 0)
+        return "registers";
+
+    if (a->cpu.cycles != b->cpu.cycles)
+        return "cycles";
+
+    if (a->cpu.ime != b->cpu.ime || a->cpu.halted != b->cpu.halted)
+        return "cpu state";
+
+    if (memcmp(a->mmu.wram, b->mmu.wram, sizeof(a->mmu.wram)) != 0)
+        return "wram";
+
+    if (memcmp(a->mmu.zram, b->mmu.zram, sizeof(a->mmu.zram)) != 0)
+        return "zram";
+
+    if (memcmp(a->mmu.eram, b->mmu.eram, sizeof(a->mmu.eram)) != 0)
+        return "eram";
+
+    if (memcmp(a->gpu.vram, b->gpu.vram, sizeof(a->gpu.vram)) != 0)
+        return "vram";
+
+    if (memcmp(a->gpu.oam.mem, b->gpu.oam.mem, sizeof(a->gpu.oam.mem)) != 0)
+        return "oam";
+
+    if (memcmp(gb_gpu_screen(&a->gpu), gb_gpu_screen(&b->gpu), screen_len) != 0)
+        return "screen";
+
+    return NULL;
+}
+
+/*
+ * Checks every instance against running it on its own. Each one is run from
+ * the start, as a batch of one, for as many frames as 'batch' has run, and
+ * then compared with the lane it ended up in.
+ *
+ * Returns the number of instances that don't match.
+ */
+int gb_batch_verify(struct gb_batch *batch)
+{
+    int i, bad = 0;
+
+    for (i = 0; i < batch->count; i++) {
+        struct batch_verify_input input = { .batch = batch, .id = i };
+        struct gb_batch single;
+        const char *diff;
+
+        if (gb_batch_init(&single, batch->filename, &batch->config, 1))
+            return batch->count;
+
+        single.get_input = batch_verify_get_input;
+        single.data = &input;
+        gb_batch_set_format(&single, batch->lanes[0]->display.format);
+
+        while (single.frame < batch->frame)
+            gb_batch_run_frame(&single);
+
+        diff = batch_compare(gb_batch_emu(batch, i), gb_batch_emu(&single, 0));
+        if (diff) {
+            printf("Batch: Instance %d differs from running it alone, first in %s\n", i, diff);
+            bad++;
+        }
+
+        gb_batch_clear(&single);
+    }
+
+    return bad;
+}
@@ -2,6 +2,8 @@
 #include "common.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <signal.h>
 
@@ -13,25 +15,10 @@
 #include "cpu_internal.h"
 #include "cpu_jit_helpers.h"
 #include "cpu_dispatcher.h"
-#include "hashtable.h"
-
-struct jit_block {
-    hlist_node_t entry;
-    uint16_t addr;
-    int bank;
-    jit_function_t func;
-    void (*run_block) (struct gb_emu *);
-};
 
 void jit_block_init(struct jit_block *block)
 {
     memset(block, 0, sizeof(*block));
-    hlist_node_init(&block->entry);
-}
-
-static int jit_block_hash(uint16_t addr, int bank)
-{
-    return (addr ^ (bank << 16)) % HASH_TABLE_SIZE;
 }
 
 void gb_emu_cpu_dispatcher_init(struct cpu_dispatcher *dispatcher)
@@ -39,29 +26,92 @@ void gb_emu_cpu_dispatcher_init(struct cpu_dispatcher *dispatcher)
     memset(dispatcher, 0, sizeof(*dispatcher));
 
     object_pool_init(&dispatcher->jit_blocks, sizeof(struct jit_block), 50);
-    dispatcher->context = jit_context_create();
+    gb_jit_compiler_init(&dispatcher->compiler);
 }
 
 void gb_emu_cpu_dispatcher_clear(struct cpu_dispatcher *dispatcher)
 {
-    jit_context_destroy(dispatcher->context);
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(dispatcher->banks); i++)
+        free(dispatcher->banks[i]);
+
+    for (i = 0; i < dispatcher->aot_compiler_count; i++)
+        gb_jit_compiler_clear(dispatcher->aot_compilers + i);
+
+    free(dispatcher->aot_compilers);
+
+    gb_jit_compiler_clear(&dispatcher->compiler);
     object_pool_clear(&dispatcher->jit_blocks);
 }
 
-void gb_emu_jit_func_create(struct gb_cpu_jit_context *ctx, struct cpu_dispatcher *dispatcher, struct gb_emu *emu, uint16_t addr)
+/* Adds the time since 'start' to the compile time */
+static void jit_stats_add(struct gb_jit_stats *stats, uint64_t start)
 {
-    jit_type_t jit_block_params[] = { jit_type_void_ptr };
-    jit_type_t jit_block_signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, jit_block_params, ARRAY_SIZE(jit_block_params), 1);
+    uint64_t ns = gb_jit_time_ns() - start;
+
+    stats->compile_ns += ns;
+    if (ns > stats->max_compile_ns)
+        stats->max_compile_ns = ns;
+}
+
+void gb_emu_dispatcher_print_stats(struct cpu_dispatcher *dispatcher, FILE *file)
+{
+    struct gb_jit_stats *stats = &dispatcher->stats;
+    unsigned int total = stats->blocks + stats->traces;
+
+    if (stats->aot_threads)
+        fprintf(file, "JIT: Compiled %u blocks ahead of time on %u threads in %.3f ms\n",
+                stats->aot_blocks, stats->aot_threads, stats->aot_ns / 1e6);
+
+    fprintf(file, "JIT: Compiled %u blocks and %u traces at runtime\n", stats->blocks, stats->traces);
+
+    if (!total)
+        return ;
+
+    fprintf(file, "JIT: Compile time: %.3f ms total, %.1f us average, %.1f us max\n",
+            stats->compile_ns / 1e6, stats->compile_ns / 1e3 / total, stats->max_compile_ns / 1e3);
+}
+
+/*
+ * Returns the slot in the block table for 'addr'. The fixed bank at
+ * 0x0000-0x3FFF always gets the first table, and the switchable banks follow
+ * it. Code in RAM goes in the last tables, regardless of the bank. The
+ * per-bank tables are only allocated once we compile something in that bank.
+ */
+struct jit_block **gb_emu_dispatcher_block_slot(struct cpu_dispatcher *dispatcher, uint16_t addr, int bank)
+{
+    int table = 0;
+
+    if (addr >= 0x8000)
+        table = GB_JIT_BANK_COUNT + 1 + ((addr - 0x8000) / GB_JIT_BANK_SIZE);
+    else if (addr >= GB_JIT_BANK_SIZE)
+        table = (bank % GB_JIT_BANK_COUNT) + 1;
 
+    if (!dispatcher->banks[table])
+        dispatcher->banks[table] = calloc(GB_JIT_BANK_SIZE, sizeof(*dispatcher->banks[table]));
+
+    return &dispatcher->banks[table][addr & (GB_JIT_BANK_SIZE - 1)];
+}
+
+void gb_emu_jit_func_create(struct gb_cpu_jit_context *ctx, struct cpu_dispatcher *dispatcher, struct gb_jit_compiler *compiler, struct gb_emu *emu, uint16_t addr, int bank)
+{
     memset(ctx, 0, sizeof(*ctx));
 
     ctx->dispatcher = dispatcher;
-    ctx->context = dispatcher->context;
+    ctx->context = compiler->context;
+    ctx->sigs = &compiler->sigs;
     ctx->gb_emu = emu;
     ctx->addr = addr;
+    ctx->bank = bank;
     ctx->func_exit_label = jit_label_undefined;
 
-    ctx->func = jit_function_create(dispatcher->context, jit_block_signature);;
+    /* Code in the fixed bank is shared by every bank, so nothing is known
+     * about the bank at 0x4000 until it is checked */
+    ctx->bank_dirty = (addr < GB_JIT_BANK_SIZE);
+
+    /* Compiled blocks have the signature 'void (struct gb_emu *)' */
+    ctx->func = jit_function_create(ctx->context, ctx->sigs->emu_void);
     ctx->emu = jit_value_get_param(ctx->func, 0);
 
     int i;
@@ -74,61 +124,477 @@ void gb_emu_jit_func_exit(struct gb_cpu_jit_context *ctx)
     jit_insn_branch(ctx->func, &ctx->func_exit_label);
 }
 
-void (*gb_emu_jit_func_complete(struct gb_cpu_jit_context *ctx)) (struct gb_emu *)
+/* Writes the cached registers back into the gb_emu, so native code we call
+ * sees their current values */
+void gb_emu_jit_func_flush_regs(struct gb_cpu_jit_context *ctx)
 {
-    jit_insn_label(ctx->func, &ctx->func_exit_label);
-
     int i;
     for (i = 0; i < ARRAY_SIZE(ctx->regs); i++)
         jit_insn_store_relative(ctx->func, ctx->emu, GB_REG8_OFFSET(i), jit_insn_convert(ctx->func, ctx->regs[i], jit_type_ubyte, 0));
+}
+
+void (*gb_emu_jit_func_complete(struct gb_cpu_jit_context *ctx)) (struct gb_emu *)
+{
+    jit_insn_label(ctx->func, &ctx->func_exit_label);
+
+    gb_emu_jit_func_flush_regs(ctx);
 
     jit_insn_default_return(ctx->func);
     jit_function_compile(ctx->func);
     return jit_function_to_closure(ctx->func);
 }
 
-void gb_emu_run_dispatcher(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+/*
+ * Decodes the branch at 'addr', returning where it goes if it is taken and if
+ * it isn't. Branches with a target we can't know ahead of time (RET, RETI,
+ * JP (HL)) can't be followed, so they come back as JIT_BRANCH_NONE.
+ */
+enum jit_branch gb_jit_branch_decode(struct gb_emu *emu, int bank, uint16_t addr, uint16_t *taken, uint16_t *fallthrough)
 {
-    while (!emu->stop_emu) {
-        if (gb_emu_addr_is_rom(emu, emu->cpu.r.w[GB_REG_PC])) {
-            /* Check if it is already compiled */
-            uint16_t addr = emu->cpu.r.w[GB_REG_PC];
-            int bank = emu->mmu.mbc_controller->get_bank(emu, addr);
-            struct jit_block *block, *found = NULL;
-            int hash = jit_block_hash(addr, bank);
+    uint8_t opcode = gb_jit_fetch8(emu, bank, addr);
 
-            hlist_foreach_entry(&dispatcher->htable.table[hash], block, entry) {
-                if (block->addr == addr && block->bank == bank) {
-                    found = block;
-                    break;
-                }
-            }
+    switch (opcode) {
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+        *fallthrough = addr + 2;
+        *taken = *fallthrough + (int8_t)gb_jit_fetch8(emu, bank, addr + 1);
+        return (opcode == 0x18)? JIT_BRANCH_UNCOND: JIT_BRANCH_COND;
 
-            if (!found) {
-                printf("Compiling [0x%04x]...\n", emu->cpu.r.w[GB_REG_PC]);
-                found = object_pool_get(&dispatcher->jit_blocks);
-                jit_block_init(found);
+    case 0xC3:
+    case 0xC2:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xCD:
+    case 0xC4:
+    case 0xCC:
+    case 0xD4:
+    case 0xDC:
+        *fallthrough = addr + 3;
+        *taken = gb_jit_fetch16(emu, bank, addr + 1);
+        return (opcode == 0xC3 || opcode == 0xCD)? JIT_BRANCH_UNCOND: JIT_BRANCH_COND;
 
-                found->addr = addr;
-                found->bank = bank;
+    case 0xC7:
+    case 0xCF:
+    case 0xD7:
+    case 0xDF:
+    case 0xE7:
+    case 0xEF:
+    case 0xF7:
+    case 0xFF:
+        *fallthrough = addr + 1;
+        *taken = opcode & 0x38;
+        return JIT_BRANCH_UNCOND;
+    }
 
-                hlist_add(&dispatcher->htable.table[hash], &found->entry);
+    return JIT_BRANCH_NONE;
+}
 
-                struct gb_cpu_jit_context jit_ctx;
-                gb_emu_jit_func_create(&jit_ctx, dispatcher, emu, addr);
+/* Returns true if the profile of 'block' says its branch almost always goes
+ * the same way, and sets 'next' to that address */
+static int jit_block_hot_path(struct jit_block *block, uint16_t *next)
+{
+    unsigned int total = block->taken + block->not_taken;
 
-                while (!gb_emu_cpu_jit_run_next_inst(&jit_ctx))
-                    ;
+    if (block->branch != JIT_BRANCH_COND || total < GB_JIT_TRACE_THRESHOLD)
+        return 0;
 
-                found->run_block = gb_emu_jit_func_complete(&jit_ctx);
-            }
+    if (block->taken * 8 >= total * 7) {
+        *next = block->taken_addr;
+        return 1;
+    }
 
-            (found->run_block) (emu);
+    if (block->not_taken * 8 >= total * 7) {
+        *next = block->fallthrough_addr;
+        return 1;
+    }
 
+    return 0;
+}
+
+/* A trace can only follow a branch if the code it lands on is fixed while the
+ * trace runs. Code in the switchable bank is fine as long as the bank is the
+ * one the trace was compiled for, which is guarded for. */
+static int jit_trace_can_follow(struct gb_emu *emu, uint16_t next)
+{
+    return gb_emu_addr_is_rom(emu, next);
+}
+
+static int jit_is_breakpoint(struct gb_emu *emu, uint16_t addr)
+{
+    int i;
+
+    if (!emu->break_flag)
+        return 0;
+
+    for (i = 0; i < emu->breakpoint_count; i++)
+        if (emu->breakpoints[i] == addr)
+            return 1;
+
+    return 0;
+}
+
+/* Compiles the instructions at 'addr' up to the first jump, and returns the
+ * address of that jump.
+ *
+ * Breakpoints are checked between instructions, so we also stop before any
+ * instruction with a breakpoint on it. The dispatcher then checks for it once
+ * the block returns. */
+static uint16_t jit_compile_to_branch(struct gb_cpu_jit_context *ctx)
+{
+    uint16_t inst_addr;
+
+    do {
+        inst_addr = ctx->addr;
+    } while (!gb_emu_cpu_jit_run_next_inst(ctx) && !jit_is_breakpoint(ctx->gb_emu, ctx->addr));
+
+    return inst_addr;
+}
+
+/* Compiles 'block' into 'context'. Nothing here touches the dispatcher or the
+ * current state of the gb_emu, so blocks can be compiled from several
+ * threads at once as long as each one has its own context. */
+void gb_emu_dispatcher_compile_block(struct cpu_dispatcher *dispatcher, struct gb_jit_compiler *compiler, struct gb_emu *emu, struct jit_block *block)
+{
+    struct gb_cpu_jit_context jit_ctx;
+    uint8_t code[GB_CPU_IDIOM_MAX_LEN];
+    uint8_t loop[GB_SPEED_HACKS_LOOP_LEN];
+    uint16_t branch_addr;
+    int i;
+
+    for (i = 0; i < GB_CPU_IDIOM_MAX_LEN; i++)
+        code[i] = gb_jit_fetch8(emu, block->bank, block->addr + i);
+
+    block->idiom = gb_cpu_idiom_match(code);
+
+    block->idle = 0;
+    if (gb_speed_hacks_find(&emu->hacks, GB_HACK_IDLE, block->addr, block->bank)) {
+        for (i = 0; i < GB_SPEED_HACKS_LOOP_LEN; i++)
+            loop[i] = gb_jit_fetch8(emu, block->bank, block->addr + i);
+
+        block->idle = gb_speed_hacks_is_wait_loop(loop);
+    }
+
+    gb_emu_jit_func_create(&jit_ctx, dispatcher, compiler, emu, block->addr, block->bank);
+
+    branch_addr = jit_compile_to_branch(&jit_ctx);
+    block->branch = gb_jit_branch_decode(emu, block->bank, branch_addr, &block->taken_addr, &block->fallthrough_addr);
+    block->end_addr = jit_ctx.addr;
+
+    block->run_block = gb_emu_jit_func_complete(&jit_ctx);
+}
+
+/*
+ * Recompiles 'block' as a trace - Rather then stopping at the first jump, we
+ * keep compiling along the direction each branch has almost always gone,
+ * using the profiles of the blocks we pass through. The register cache then
+ * covers the whole trace instead of a single block.
+ *
+ * Every conditional branch we compile through gets a guard, which leaves the
+ * trace through the normal exit if the branch went the other way. The branch
+ * itself has already set PC, so the dispatcher picks up from there.
+ *
+ * Traces starting in the fixed bank are shared by every bank, so the first
+ * jump they make into the switchable bank gets the same kind of guard on the
+ * current bank. After that, only jumps there after code in the fixed bank
+ * wrote to the MBC need another one. Jumps into the fixed bank never need
+ * one.
+ *
+ * The trace ends at a branch we can't follow, a branch without a strong
+ * bias, a breakpoint, or once it comes back around to code it already
+ * contains.
+ */
+static void jit_block_compile_trace(struct cpu_dispatcher *dispatcher, struct gb_emu *emu, struct jit_block *block)
+{
+    struct gb_cpu_jit_context jit_ctx;
+    uint16_t visited[GB_JIT_TRACE_MAX_BLOCKS];
+    int count = 0;
+
+    DEBUG_PRINTF("Compiling trace [0x%04x]...\n", block->addr);
+
+    gb_emu_jit_func_create(&jit_ctx, dispatcher, &dispatcher->compiler, emu, block->addr, block->bank);
+
+    while (1) {
+        struct jit_block *seg;
+        jit_label_t on_trace = jit_label_undefined;
+        uint16_t branch_addr, taken, fallthrough, next;
+        enum jit_branch branch;
+        int i;
+
+        visited[count++] = jit_ctx.addr;
+
+        branch_addr = jit_compile_to_branch(&jit_ctx);
+        branch = gb_jit_branch_decode(emu, block->bank, branch_addr, &taken, &fallthrough);
+
+        if (branch == JIT_BRANCH_NONE)
+            break;
+
+        if (branch == JIT_BRANCH_COND) {
+            if (count == 1)
+                seg = block;
+            else
+                seg = *gb_emu_dispatcher_block_slot(dispatcher, visited[count - 1], block->bank);
+
+            if (!seg || !jit_block_hot_path(seg, &next))
+                break;
         } else {
-            /* For addresses that aren't read-only ROM, we use the interpreter rather then the JIT */
-            gb_emu_cpu_run_next_inst(emu);
+            next = taken;
+        }
+
+        if (count == GB_JIT_TRACE_MAX_BLOCKS || !jit_trace_can_follow(emu, next))
+            break;
+
+        if (jit_is_breakpoint(emu, next))
+            break;
+
+        /* Idle loops have to start a block, so the dispatcher sees them */
+        if (gb_speed_hacks_find(&emu->hacks, GB_HACK_IDLE, next, block->bank))
+            break;
+
+        for (i = 0; i < count; i++)
+            if (visited[i] == next)
+                break;
+
+        if (i != count)
+            break;
+
+        if (branch == JIT_BRANCH_COND) {
+            jit_value_t pc = gb_jit_load_reg16(&jit_ctx, GB_REG_PC);
+
+            jit_insn_branch_if(jit_ctx.func, jit_insn_eq(jit_ctx.func, pc, GB_JIT_CONST_USHORT(jit_ctx.func, next)), &on_trace);
+            gb_emu_jit_func_exit(&jit_ctx);
+            jit_insn_label(jit_ctx.func, &on_trace);
+        }
+
+        /* The bank may not be the one we compiled for, or code in the fixed
+         * bank may have switched it on the way here */
+        if (next >= GB_JIT_BANK_SIZE && jit_ctx.bank_dirty) {
+            gb_jit_bank_guard(&jit_ctx);
+            jit_ctx.bank_dirty = 0;
         }
+
+        jit_ctx.addr = next;
+    }
+
+    block->is_trace = 1;
+    block->run_block = gb_emu_jit_func_complete(&jit_ctx);
+}
+
+/* Records which way the branch at the end of 'block' went, and turns the
+ * block into a trace once it has been run enough times with a clear bias */
+static void jit_block_profile(struct cpu_dispatcher *dispatcher, struct gb_emu *emu, struct jit_block *block)
+{
+    uint16_t pc = emu->cpu.r.w[GB_REG_PC];
+    uint16_t next;
+
+    if (pc == block->taken_addr)
+        block->taken++;
+    else if (pc == block->fallthrough_addr)
+        block->not_taken++;
+    else
+        return ; /* An interrupt was taken */
+
+    if ((block->taken + block->not_taken) % GB_JIT_TRACE_THRESHOLD)
+        return ;
+
+    if (jit_block_hot_path(block, &next)) {
+        uint64_t start = gb_jit_time_ns();
+
+        jit_block_compile_trace(dispatcher, emu, block);
+
+        dispatcher->stats.traces++;
+        jit_stats_add(&dispatcher->stats, start);
+    }
+}
+
+/* Adds a new, uncompiled, block to the table */
+struct jit_block *gb_emu_dispatcher_new_block(struct cpu_dispatcher *dispatcher, uint16_t addr, int bank)
+{
+    struct jit_block *block = object_pool_get(&dispatcher->jit_blocks);
+
+    jit_block_init(block);
+
+    block->addr = addr;
+    block->bank = bank;
+
+    *gb_emu_dispatcher_block_slot(dispatcher, addr, bank) = block;
+
+    return block;
+}
+
+static struct jit_block *gb_emu_dispatcher_get_block(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    /* Check if it is already compiled.
+     *
+     * Blocks in the fixed bank are shared by every bank, so they end when
+     * they run into 0x4000 rather then going on with whatever bank is mapped
+     * when they are compiled. They're still recorded with that bank, which
+     * is what their bank guards check against. */
+    uint16_t addr = emu->cpu.r.w[GB_REG_PC];
+    int bank = emu->mmu.mbc_controller->get_bank(emu, GB_JIT_BANK_SIZE);
+    struct jit_block **slot = gb_emu_dispatcher_block_slot(dispatcher, addr, bank);
+    struct jit_block *found = *slot;
+
+    if (!found) {
+        uint64_t start = gb_jit_time_ns();
+
+        DEBUG_PRINTF("Compiling [0x%04x]...\n", addr);
+        found = gb_emu_dispatcher_new_block(dispatcher, addr, bank);
+        gb_emu_dispatcher_compile_block(dispatcher, &dispatcher->compiler, emu, found);
+
+        dispatcher->stats.blocks++;
+        jit_stats_add(&dispatcher->stats, start);
     }
+
+    return found;
 }
 
+/* Returns true if a breakpoint falls inside of 'block', rather then at its
+ * start. Traces cover too many ranges to bother with, so they always count. */
+static int jit_block_has_breakpoint(struct gb_emu *emu, struct jit_block *block)
+{
+    int i;
+
+    if (block->is_trace)
+        return 1;
+
+    for (i = 0; i < emu->breakpoint_count; i++)
+        if (emu->breakpoints[i] > block->addr && emu->breakpoints[i] < block->end_addr)
+            return 1;
+
+    return 0;
+}
+
+/*
+ * When breakpoints are added or turned on, any blocks compiled through one of
+ * them are dropped from the table, so they get recompiled and split at the
+ * breakpoint. Their code stays around until the dispatcher is cleared.
+ *
+ * Removing breakpoints doesn't need anything, the split blocks still work.
+ */
+static void jit_dispatcher_check_breakpoints(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    int i, k;
+
+    if (dispatcher->breakpoint_gen == emu->breakpoint_gen && dispatcher->break_flag == emu->break_flag)
+        return ;
+
+    dispatcher->breakpoint_gen = emu->breakpoint_gen;
+    dispatcher->break_flag = emu->break_flag;
+
+    if (!emu->break_flag)
+        return ;
+
+    for (i = 0; i < ARRAY_SIZE(dispatcher->banks); i++) {
+        if (!dispatcher->banks[i])
+            continue;
+
+        for (k = 0; k < GB_JIT_BANK_SIZE; k++) {
+            struct jit_block *block = dispatcher->banks[i][k];
+
+            if (block && jit_block_has_breakpoint(emu, block))
+                dispatcher->banks[i][k] = NULL;
+        }
+    }
+}
+
+/* Returns true if the code at 'addr' can be compiled - Either it is in ROM,
+ * or the speed hacks say it is RAM code that doesn't change */
+static int jit_addr_is_compiled(struct gb_emu *emu, uint16_t addr)
+{
+    if (gb_emu_addr_is_rom(emu, addr))
+        return 1;
+
+    return emu->hacks.count && gb_speed_hacks_find(&emu->hacks, GB_HACK_RAM_CODE, addr, 0);
+}
+
+/*
+ * Runs 'block', after running as much of it as we can in bulk if it is a copy
+ * or fill loop. The bulk passes end on the loop's branch, which is followed by
+ * an interrupt check like any other instruction. Idle loops skip ahead to the
+ * next event the same way, and then run once.
+ */
+static void jit_block_run(struct gb_emu *emu, struct jit_block *block)
+{
+    if (block->idiom && gb_cpu_idiom_run(emu, block->idiom) && gb_emu_check_interrupt(emu))
+        return ;
+
+    if (block->idle) {
+        gb_emu_idle_skip(emu);
+        if (gb_emu_check_interrupt(emu))
+            return ;
+    }
+
+    (block->run_block) (emu);
+}
+
+/*
+ * Called from compiled code once a HALT has been woken up, to run the block
+ * at the interrupt vector without going back through the dispatcher loop.
+ *
+ * The block we run may also halt and call us again, so we only go one level
+ * deep to keep the native stack bounded.
+ */
+void gb_emu_dispatcher_resume(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    struct jit_block *block;
+
+    gb_emu_cpu_breakpoint_check(emu);
+
+    if (dispatcher->resume_depth || emu->stop_emu || emu->hook_flag)
+        return ;
+
+    if (!jit_addr_is_compiled(emu, emu->cpu.r.w[GB_REG_PC]))
+        return ;
+
+    block = gb_emu_dispatcher_get_block(dispatcher, emu);
+
+    dispatcher->resume_depth++;
+    jit_block_run(emu, block);
+    dispatcher->resume_depth--;
+}
+
+/* Runs the next block of code, either compiled or through the interpreter */
+void gb_emu_dispatcher_step(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    /* Compiled code doesn't call the per-instruction hooks, so while they are
+     * on everything goes through the interpreter */
+    if (emu->hook_flag) {
+        gb_emu_cpu_run_next_inst(emu);
+        return ;
+    }
+
+    jit_dispatcher_check_breakpoints(dispatcher, emu);
+
+    /* Compiled code never starts halted, the interpreter may have left us
+     * halted though */
+    if (emu->cpu.halted) {
+        gb_emu_halt_skip(emu);
+        gb_emu_cpu_breakpoint_check(emu);
+        return ;
+    }
+
+    if (jit_addr_is_compiled(emu, emu->cpu.r.w[GB_REG_PC])) {
+        struct jit_block *block = gb_emu_dispatcher_get_block(dispatcher, emu);
+
+        jit_block_run(emu, block);
+
+        gb_emu_cpu_breakpoint_check(emu);
+
+        if (block->branch == JIT_BRANCH_COND && !block->is_trace)
+            jit_block_profile(dispatcher, emu, block);
+    } else {
+        /* For addresses that aren't read-only ROM, or RAM code from the speed
+         * hacks, we use the interpreter rather then the JIT */
+        gb_emu_cpu_run_next_inst(emu);
+    }
+}
+
+void gb_emu_run_dispatcher(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    while (!emu->stop_emu)
+        gb_emu_dispatcher_step(dispatcher, emu);
+}
@@ -2,20 +2,118 @@
 #define GBEMUC_GB_CPU_DISPATCHER_H
 
 #include "gb.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
 #include <jit/jit.h>
 
-#include "hashtable.h"
 #include "object_pool.h"
 
-struct cpu_dispatcher {
+/* Compiled blocks are looked up by ROM bank, and then by their offset into
+ * that bank. 512 banks covers the largest MBC5 cart. Code in RAM that the
+ * speed hacks let us compile gets GB_JIT_RAM_TABLES more tables after those. */
+#define GB_JIT_BANK_SIZE 0x4000
+#define GB_JIT_BANK_COUNT 512
+#define GB_JIT_RAM_TABLES 2
+
+/* Blocks ending in a conditional branch are profiled, and recompiled as a
+ * trace along the usual path every GB_JIT_TRACE_THRESHOLD runs until one
+ * is made. Traces are limited to GB_JIT_TRACE_MAX_BLOCKS blocks. */
+#define GB_JIT_TRACE_THRESHOLD 64
+#define GB_JIT_TRACE_MAX_BLOCKS 8
+
+enum jit_branch {
+    JIT_BRANCH_NONE,
+    JIT_BRANCH_UNCOND,
+    JIT_BRANCH_COND,
+};
+
+struct jit_block {
+    uint16_t addr, end_addr;
+    int bank;
+    jit_function_t func;
+    void (*run_block) (struct gb_emu *);
+
+    /* The branch that ends the block, and how often each way was taken */
+    enum jit_branch branch;
+    uint16_t taken_addr, fallthrough_addr;
+    unsigned int taken, not_taken;
+
+    /* Set if the block is the start of a loop we can run in bulk */
+    const struct gb_cpu_idiom *idiom;
+
+    /* Set if the speed hacks say the block is an idle loop */
+    int idle;
+
+    int is_trace;
+};
+
+/* Signatures of the native functions compiled code calls. These are created
+ * once along with the context, rather then for every call we emit. */
+struct gb_jit_signatures {
+    jit_type_t emu_void;     /* void (struct gb_emu *) */
+    jit_type_t emu_int;      /* int (struct gb_emu *) */
+    jit_type_t read8;        /* uint8_t (struct gb_emu *, uint16_t) */
+    jit_type_t write8;       /* void (struct gb_emu *, uint16_t, uint8_t) */
+    jit_type_t read16;       /* uint16_t (struct gb_emu *, uint16_t) */
+    jit_type_t write16;      /* void (struct gb_emu *, uint16_t, uint16_t) */
+    jit_type_t ptr_ptr_void; /* void (void *, void *) */
+};
+
+/* A libjit context, and everything needed to compile into it. Only one thread
+ * can compile with a given gb_jit_compiler at a time. */
+struct gb_jit_compiler {
     jit_context_t context;
-    struct hashtable htable;
+    struct gb_jit_signatures sigs;
+};
+
+struct gb_jit_stats {
+    unsigned int blocks, traces;
+    uint64_t compile_ns, max_compile_ns;
+
+    /* --jit-aot only */
+    unsigned int aot_blocks, aot_threads;
+    uint64_t aot_ns;
+};
+
+static inline uint64_t gb_jit_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct cpu_dispatcher {
+    struct gb_jit_compiler compiler;
+    struct jit_block **banks[GB_JIT_BANK_COUNT + 1 + GB_JIT_RAM_TABLES];
     struct object_pool jit_blocks;
+
+    /* Extra compilers used by the ahead-of-time compile threads. The code
+     * they hold lives as long as the dispatcher does. */
+    struct gb_jit_compiler *aot_compilers;
+    int aot_compiler_count;
+
+    struct gb_jit_stats stats;
+
+    /* The breakpoint state the compiled blocks were split for */
+    unsigned int breakpoint_gen;
+    unsigned int break_flag;
+
+    int resume_depth;
+};
+
+enum jit_mbc_write {
+    JIT_MBC_NONE,
+    JIT_MBC_MAYBE,  /* Written through a register, check 'mbc_addr' */
+    JIT_MBC_ALWAYS, /* Written through a constant address below 0x8000 */
 };
 
 struct gb_cpu_jit_context {
     struct cpu_dispatcher *dispatcher;
     jit_context_t context;
+    struct gb_jit_signatures *sigs;
     jit_function_t func;
     jit_value_t emu;
     jit_label_t func_exit_label;
@@ -24,6 +122,17 @@ struct gb_cpu_jit_context {
 
     struct gb_emu *gb_emu;
     uint16_t addr;
+    int bank;
+
+    /* Set by the current instruction if it may have written to the MBC, and
+     * so changed the bank mapped at 0x4000 */
+    enum jit_mbc_write mbc_write;
+    jit_value_t mbc_addr;
+
+    /* Set while the bank at 0x4000 may not be 'bank' - from the start of
+     * code in the fixed bank, and once it may have changed the bank. Compiled
+     * code that runs in the switchable bank after that has to check it */
+    int bank_dirty;
 };
 
 typedef void gb_cpu_jit_func_t(struct gb_emu *);
@@ -31,11 +140,23 @@ typedef void gb_cpu_jit_func_t(struct gb_emu *);
 void gb_emu_cpu_dispatcher_init(struct cpu_dispatcher *);
 void gb_emu_cpu_dispatcher_clear(struct cpu_dispatcher *);
 
-void gb_emu_jit_func_create(struct gb_cpu_jit_context *ctx, struct cpu_dispatcher *dispatcher, struct gb_emu *emu, uint16_t addr);
+void gb_emu_jit_func_create(struct gb_cpu_jit_context *ctx, struct cpu_dispatcher *dispatcher, struct gb_jit_compiler *compiler, struct gb_emu *emu, uint16_t addr, int bank);
 
 void gb_emu_jit_func_exit(struct gb_cpu_jit_context *ctx);
+void gb_emu_jit_func_flush_regs(struct gb_cpu_jit_context *ctx);
 gb_cpu_jit_func_t *gb_emu_jit_func_complete(struct gb_cpu_jit_context *ctx);
 
+struct jit_block **gb_emu_dispatcher_block_slot(struct cpu_dispatcher *, uint16_t addr, int bank);
+struct jit_block *gb_emu_dispatcher_new_block(struct cpu_dispatcher *, uint16_t addr, int bank);
+void gb_emu_dispatcher_compile_block(struct cpu_dispatcher *, struct gb_jit_compiler *, struct gb_emu *, struct jit_block *);
+enum jit_branch gb_jit_branch_decode(struct gb_emu *emu, int bank, uint16_t addr, uint16_t *taken, uint16_t *fallthrough);
+
+void gb_emu_dispatcher_aot(struct cpu_dispatcher *, struct gb_emu *);
+
+void gb_emu_dispatcher_print_stats(struct cpu_dispatcher *, FILE *);
+
+void gb_emu_dispatcher_step(struct cpu_dispatcher *, struct gb_emu *);
 void gb_emu_run_dispatcher(struct cpu_dispatcher *, struct gb_emu *);
+void gb_emu_dispatcher_resume(struct cpu_dispatcher *, struct gb_emu *);
 
 #endif
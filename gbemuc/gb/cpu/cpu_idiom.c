@@ -0,0 +1,270 @@
+
+#include "common.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gb_internal.h"
+#include "cpu_internal.h"
+#include "gb/cpu.h"
+
+/*
+ * Recognition of common copy and fill loops.
+ *
+ * Games spend a lot of time in a few small loops that copy or fill memory.
+ * When one of the loops below is found in ROM, we run as many passes around
+ * it as we can at once, rather then one instruction at a time. The result is
+ * identical to running it normally:
+ *
+ *  - We only run whole passes, and stop before the last one, so the normal
+ *    code always handles the loop exiting.
+ *  - The passes we run have to end on or before the next GPU or timer event,
+ *    so no interrupt can become pending, and no line can be rendered, part way
+ *    through. The clock is then advanced in one go, as in gb_emu_halt_skip().
+ *  - The memory touched has to be between 0x8000 and 0xFDFF. Anything else
+ *    could hit the MBC, OAM, or the I/O registers.
+ *
+ * Every loop is entered and left at its first instruction, with every
+ * register set the same as after the last pass run.
+ */
+
+enum idiom_type {
+    IDIOM_COPY,
+    IDIOM_CLEAR,
+    IDIOM_FILL,
+};
+
+struct gb_cpu_idiom {
+    const char *name;
+    enum idiom_type type;
+
+    uint8_t code[GB_CPU_IDIOM_MAX_LEN];
+    int len;
+
+    /* Cycles for one pass around the loop, with the branch taken */
+    int cycles;
+
+    /* Fills only - The direction HL moves in, and which of B or C is the
+     * counter */
+    int step;
+    int count_reg;
+};
+
+static const struct gb_cpu_idiom cpu_idioms[] = {
+    /* LD A, (HL+); LD (DE), A; INC DE; DEC BC; LD A, B; OR C; JR NZ */
+    { .name = "copy", .type = IDIOM_COPY,
+      .code = { 0x2A, 0x12, 0x13, 0x0B, 0x78, 0xB1, 0x20, 0xF8 }, .len = 8, .cycles = 52 },
+
+    /* XOR A; LD (HL+), A; DEC BC; LD A, B; OR C; JR NZ */
+    { .name = "clear", .type = IDIOM_CLEAR,
+      .code = { 0xAF, 0x22, 0x0B, 0x78, 0xB1, 0x20, 0xF9 }, .len = 7, .cycles = 40 },
+
+    /* LD (HL+), A or LD (HL-), A; DEC B or DEC C; JR NZ */
+    { .name = "fill", .type = IDIOM_FILL,
+      .code = { 0x22, 0x05, 0x20, 0xFC }, .len = 4, .cycles = 24, .step = 1, .count_reg = GB_REG_B },
+    { .name = "fill", .type = IDIOM_FILL,
+      .code = { 0x22, 0x0D, 0x20, 0xFC }, .len = 4, .cycles = 24, .step = 1, .count_reg = GB_REG_C },
+    { .name = "fill", .type = IDIOM_FILL,
+      .code = { 0x32, 0x05, 0x20, 0xFC }, .len = 4, .cycles = 24, .step = -1, .count_reg = GB_REG_B },
+    { .name = "fill", .type = IDIOM_FILL,
+      .code = { 0x32, 0x0D, 0x20, 0xFC }, .len = 4, .cycles = 24, .step = -1, .count_reg = GB_REG_C },
+};
+
+/* Returns true if any of the loops starts with 'opcode' */
+static int idiom_starts_with(uint8_t opcode)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cpu_idioms); i++)
+        if (cpu_idioms[i].code[0] == opcode)
+            return 1;
+
+    return 0;
+}
+
+const struct gb_cpu_idiom *gb_cpu_idiom_match(const uint8_t *code)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(cpu_idioms); i++)
+        if (memcmp(cpu_idioms[i].code, code, cpu_idioms[i].len) == 0)
+            return cpu_idioms + i;
+
+    return NULL;
+}
+
+/* Limits 'n' passes so that the bytes written starting at 'addr' stay in
+ * memory that is safe to touch in bulk */
+static unsigned int idiom_limit_range(unsigned int n, uint16_t addr, int step)
+{
+    unsigned int room;
+
+    if (addr < 0x8000 || addr >= 0xFE00)
+        return 0;
+
+    if (step > 0)
+        room = 0xFE00 - addr;
+    else
+        room = addr - 0x8000 + 1;
+
+    return (n < room)? n: room;
+}
+
+/* Returns how many passes around the loop can be run in bulk right now */
+static unsigned int idiom_passes(struct gb_emu *emu, const struct gb_cpu_idiom *idiom)
+{
+    struct gb_cpu *cpu = &emu->cpu;
+    unsigned int count, n;
+
+    if (emu->stop_emu || emu->hook_flag || emu->break_flag || cpu->int_count)
+        return 0;
+
+    if (cpu->ime && (cpu->int_enabled & cpu->int_flags & ((1 << GB_INT_TOTAL) - 1)))
+        return 0;
+
+    if (emu->mmu.hdma_active && emu->gpu.mode == GB_GPU_MODE_HBLANK)
+        return 0;
+
+    if (idiom->type == IDIOM_FILL)
+        count = cpu->r.b[idiom->count_reg]? cpu->r.b[idiom->count_reg]: 0x100;
+    else
+        count = cpu->r.w[GB_REG_BC]? cpu->r.w[GB_REG_BC]: 0x10000;
+
+    /* The last pass exits the loop, which we leave to the normal code */
+    n = count - 1;
+
+    count = gb_emu_clock_event_cycles(emu) / idiom->cycles;
+    if (n > count)
+        n = count;
+
+    switch (idiom->type) {
+    case IDIOM_COPY:
+        /* Reading ROM is fine, writing it is not */
+        if (cpu->r.w[GB_REG_HL] >= 0xFE00)
+            return 0;
+
+        if (n > 0xFE00u - cpu->r.w[GB_REG_HL])
+            n = 0xFE00 - cpu->r.w[GB_REG_HL];
+
+        n = idiom_limit_range(n, cpu->r.w[GB_REG_DE], 1);
+        break;
+
+    case IDIOM_CLEAR:
+        n = idiom_limit_range(n, cpu->r.w[GB_REG_HL], 1);
+        break;
+
+    case IDIOM_FILL:
+        n = idiom_limit_range(n, cpu->r.w[GB_REG_HL], idiom->step);
+        break;
+    }
+
+    return n;
+}
+
+/* Runs 'n' passes around the loop, leaving the registers as the last one
+ * would. Every pass takes the branch, so the counter never reaches zero. */
+static void idiom_exec(struct gb_emu *emu, const struct gb_cpu_idiom *idiom, unsigned int n)
+{
+    struct gb_cpu *cpu = &emu->cpu;
+    unsigned int i;
+    uint8_t flags;
+
+    switch (idiom->type) {
+    case IDIOM_COPY:
+        for (i = 0; i < n; i++)
+            gb_emu_write8(emu, cpu->r.w[GB_REG_DE]++, gb_emu_read8(emu, cpu->r.w[GB_REG_HL]++));
+
+        cpu->r.w[GB_REG_BC] -= n;
+        cpu->r.b[GB_REG_A] = cpu->r.b[GB_REG_B] | cpu->r.b[GB_REG_C];
+        cpu->r.b[GB_REG_F] = 0;
+        break;
+
+    case IDIOM_CLEAR:
+        for (i = 0; i < n; i++)
+            gb_emu_write8(emu, cpu->r.w[GB_REG_HL]++, 0);
+
+        cpu->r.w[GB_REG_BC] -= n;
+        cpu->r.b[GB_REG_A] = cpu->r.b[GB_REG_B] | cpu->r.b[GB_REG_C];
+        cpu->r.b[GB_REG_F] = 0;
+        break;
+
+    case IDIOM_FILL:
+        for (i = 0; i < n; i++) {
+            gb_emu_write8(emu, cpu->r.w[GB_REG_HL], cpu->r.b[GB_REG_A]);
+            cpu->r.w[GB_REG_HL] += idiom->step;
+        }
+
+        cpu->r.b[idiom->count_reg] -= n;
+
+        /* DEC keeps the carry, and half-carries when the low nibble wraps */
+        flags = (cpu->r.b[GB_REG_F] & GB_FLAG_CARRY) | GB_FLAG_SUB;
+        if ((cpu->r.b[idiom->count_reg] & 0x0F) == 0x0F)
+            flags |= GB_FLAG_HCARRY;
+
+        cpu->r.b[GB_REG_F] = flags;
+        break;
+    }
+}
+
+/* Runs the loop at PC in bulk for as long as we can. Returns the number of
+ * cycles used, which is zero if nothing could be done. */
+int gb_cpu_idiom_run(struct gb_emu *emu, const struct gb_cpu_idiom *idiom)
+{
+    unsigned int n;
+    int cycles = 0;
+
+    if (emu->config.no_idioms)
+        return 0;
+
+    while ((n = idiom_passes(emu, idiom))) {
+        idiom_exec(emu, idiom, n);
+
+        gb_emu_clock_advance(emu, n * idiom->cycles);
+        cycles += n * idiom->cycles;
+    }
+
+    if (cycles)
+        DEBUG_PRINTF("Bulk %s at 0x%04x, %d cycles\n", idiom->name, emu->cpu.r.w[GB_REG_PC], cycles);
+
+    return cycles;
+}
+
+/* Called by the interpreter after it takes a JR backwards, in case it landed
+ * at the start of one of the loops.
+ *
+ * This runs for every wait loop as well, so the first opcode is checked on
+ * its own through the fetch pointer, which it's about to be fetched through
+ * anyway. Only the loops we know get read in full, straight from the ROM
+ * when they don't cross a page. */
+int gb_cpu_idiom_try(struct gb_emu *emu)
+{
+    uint8_t buf[GB_CPU_IDIOM_MAX_LEN];
+    const uint8_t *code;
+    const struct gb_cpu_idiom *idiom;
+    uint16_t pc = emu->cpu.r.w[GB_REG_PC];
+    int i;
+
+    if (emu->config.no_idioms || !gb_emu_addr_is_rom(emu, pc))
+        return 0;
+
+    if (!idiom_starts_with(gb_emu_peek_pc8(emu)))
+        return 0;
+
+    code = NULL;
+    if ((pc & 0xFF) <= 0x100 - GB_CPU_IDIOM_MAX_LEN)
+        code = gb_mmu_read_ptr(emu, pc);
+
+    if (!code) {
+        for (i = 0; i < GB_CPU_IDIOM_MAX_LEN; i++)
+            buf[i] = gb_emu_read8(emu, pc + i);
+
+        code = buf;
+    }
+
+    idiom = gb_cpu_idiom_match(code);
+    if (!idiom)
+        return 0;
+
+    return gb_cpu_idiom_run(emu, idiom);
+}
@@ -5,24 +5,55 @@
 
 int gb_emu_cpu_run_next_inst(struct gb_emu *emu);
 int gb_emu_check_interrupt(struct gb_emu *emu);
+void gb_emu_halt_skip(struct gb_emu *emu);
+int gb_emu_idle_skip(struct gb_emu *emu);
+int gb_emu_is_idle_loop(struct gb_emu *emu, uint16_t addr);
+void gb_emu_cpu_breakpoint_check(struct gb_emu *emu);
 int gb_emu_hdma_check(struct gb_emu *emu);
 void gb_emu_run_interpreter(struct gb_emu *emu);
 
+/* Copy and fill loops that can be run in bulk, see cpu_idiom.c */
+#define GB_CPU_IDIOM_MAX_LEN 8
+
+struct gb_cpu_idiom;
+
+const struct gb_cpu_idiom *gb_cpu_idiom_match(const uint8_t *code);
+int gb_cpu_idiom_run(struct gb_emu *emu, const struct gb_cpu_idiom *idiom);
+int gb_cpu_idiom_try(struct gb_emu *emu);
+
 #ifdef CONFIG_JIT
 # include "cpu_dispatcher.h"
+# include <stdlib.h>
 static inline void gb_emu_run_jit(struct gb_emu *emu) {
-        struct cpu_dispatcher dispatcher;
+        struct cpu_dispatcher *dispatcher = malloc(sizeof(*dispatcher));
+
+        gb_emu_cpu_dispatcher_init(dispatcher);
+
+        if (emu->config.jit_aot)
+            gb_emu_dispatcher_aot(dispatcher, emu);
+
+        gb_emu_run_dispatcher(dispatcher, emu);
+
+        if (emu->config.jit_stats)
+            gb_emu_dispatcher_print_stats(dispatcher, stdout);
 
-        gb_emu_cpu_dispatcher_init(&dispatcher);
-        gb_emu_run_dispatcher(&dispatcher, emu);
-        gb_emu_cpu_dispatcher_clear(&dispatcher);
+        gb_emu_cpu_dispatcher_clear(dispatcher);
+
+        free(dispatcher);
 }
+
+void gb_emu_run_jit_verify(struct gb_emu *emu);
 #else
 # include <stdio.h>
 static inline void gb_emu_run_jit(struct gb_emu *emu)
 {
     fprintf(stderr, "Error: JIT supported not compiled\n");
 }
+
+static inline void gb_emu_run_jit_verify(struct gb_emu *emu)
+{
+    fprintf(stderr, "Error: JIT supported not compiled\n");
+}
 #endif
 
 extern const uint16_t gb_daa_table[];
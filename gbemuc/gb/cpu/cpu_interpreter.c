@@ -1062,17 +1062,37 @@ static int jp_hl(struct gb_emu *emu, uint8_t opcode)
     return cycles;
 }
 
+/* The rest of JR once the condition is known, reading the offset and taking
+ * the jump if 'jump' is set */
+static inline int jp_rel_finish(struct gb_emu *emu, uint8_t opcode, int jump)
+{
+    int cycles = 4;
+
+    gb_emu_clock_tick(emu);
+
+    if (jump) {
+        gb_emu_clock_tick(emu);
+        int8_t tmp = gb_emu_next_pc8(emu);
+        emu->cpu.r.w[GB_REG_PC] += tmp;
+        cycles += 4;
+
+        /* Every loop we can run in bulk ends with this */
+        if (opcode == 0x20 && tmp < 0)
+            cycles += gb_cpu_idiom_try(emu);
+    } else {
+        emu->cpu.r.w[GB_REG_PC] += 1;
+    }
+
+    return cycles;
+}
+
 /* JP n (8-bits).
  * JP cc, n */
 static int jp_rel(struct gb_emu *emu, uint8_t opcode)
 {
-    int cycles = 0;
     int jump = 0;
     uint8_t flags;
 
-    cycles += 4;
-    gb_emu_clock_tick(emu);
-
     flags = emu->cpu.r.b[GB_REG_F];
 
     switch (opcode) {
@@ -1101,16 +1121,7 @@ static int jp_rel(struct gb_emu *emu, uint8_t opcode)
         break;
     }
 
-    if (jump) {
-        gb_emu_clock_tick(emu);
-        int8_t tmp = gb_emu_next_pc8(emu);
-        emu->cpu.r.w[GB_REG_PC] += tmp;
-        cycles += 4;
-    } else {
-        emu->cpu.r.w[GB_REG_PC] += 1;
-    }
-
-    return cycles;
+    return jp_rel_finish(emu, opcode, jump);
 }
 
 /*
@@ -1609,18 +1620,63 @@ int gb_emu_check_interrupt(struct gb_emu *emu)
     return ret;
 }
 
-int gb_emu_hdma_check(struct gb_emu *emu)
+/* Runs the clock while the CPU is halted, until an interrupt wakes it back
+ * up. Rather then ticking the clock four cycles at a time, we jump straight to
+ * the next GPU or timer event, since nothing else can set an interrupt flag
+ * while halted. */
+void gb_emu_halt_skip(struct gb_emu *emu)
 {
-    if (emu->mmu.hdma_active && emu->gpu.mode == GB_GPU_MODE_HBLANK) {
-        int i;
+    gb_emu_check_interrupt(emu);
 
-        for (i = 0; i < 16 && emu->mmu.hdma_length_left; i++) {
-            gb_emu_write8(emu, emu->mmu.hdma_dest, gb_emu_read8(emu, emu->mmu.hdma_source));
+    while (emu->cpu.halted && !emu->stop_emu) {
+        gb_emu_clock_advance(emu, gb_emu_clock_event_cycles(emu));
+        gb_emu_check_interrupt(emu);
+    }
+}
 
-            emu->mmu.hdma_dest++;
-            emu->mmu.hdma_source++;
-            emu->mmu.hdma_length_left--;
-        }
+/* Returns true if the speed hacks say 'addr' is the start of an idle loop,
+ * and the code there really is a wait loop. This is checked before every
+ * instruction, so anything past the bit in 'idle_addrs' only happens at the
+ * addresses with a hint. */
+int gb_emu_is_idle_loop(struct gb_emu *emu, uint16_t addr)
+{
+    uint8_t code[GB_SPEED_HACKS_LOOP_LEN];
+    int i;
+
+    if (!gb_speed_hacks_may_idle(&emu->hacks, addr))
+        return 0;
+
+    if (!gb_speed_hacks_find(&emu->hacks, GB_HACK_IDLE, addr, emu->mmu.mbc_controller->get_bank(emu, 0x4000)))
+        return 0;
+
+    for (i = 0; i < GB_SPEED_HACKS_LOOP_LEN; i++)
+        code[i] = gb_emu_read8(emu, addr + i);
+
+    return gb_speed_hacks_is_wait_loop(code);
+}
+
+/* Called at the start of an idle loop from the speed hacks. The loop only
+ * waits for an interrupt, LY or STAT, none of which change before the next
+ * GPU or timer event, so we jump straight to it. The loop is then run once as
+ * normal, to see whatever changed. Unlike gb_emu_halt_skip() this isn't exact,
+ * the loop comes out at a different point in its pass.
+ *
+ * Returns the number of cycles skipped. */
+int gb_emu_idle_skip(struct gb_emu *emu)
+{
+    int cycles = gb_emu_clock_event_cycles(emu);
+
+    gb_emu_clock_advance(emu, cycles);
+    return cycles;
+}
+
+int gb_emu_hdma_check(struct gb_emu *emu)
+{
+    if (emu->mmu.hdma_active && emu->gpu.mode == GB_GPU_MODE_HBLANK) {
+        if (emu->mmu.hdma_length_left < 16)
+            gb_emu_hdma_copy(emu, emu->mmu.hdma_length_left);
+        else
+            gb_emu_hdma_copy(emu, 16);
 
         if (!emu->mmu.hdma_length_left) {
             emu->mmu.hdma_length_left = 0xFF;
@@ -1664,6 +1720,202 @@ void gb_emu_cpu_breakpoint_check(struct gb_emu *emu)
    }
 }
 
+/*
+ *
+ * Superinstructions
+ *
+ * A few pairs of instructions make up a large part of what games run (Use
+ * --pair-profile to see them). When the second instruction of one of these
+ * pairs follows the first, both are run by a single handler, without going
+ * back through gb_emu_cpu_run_next_inst() and gb_emu_run_inst() in between,
+ * and with any branch tested on the result directly rather then through F.
+ *
+ * The clock ticks in exactly the same places as running them separately. If
+ * anything would have happened between the two instructions - an interrupt,
+ * an HDMA transfer, the emulator stopping, or an idle loop from the speed
+ * hacks - the handler stops after the first one. No pair is run while an EI
+ * is still waiting to take effect.
+ */
+
+/* Returns true if nothing needs to be done before the next instruction */
+static inline int pair_can_continue(struct gb_emu *emu)
+{
+    if (emu->stop_emu)
+        return 0;
+
+    if (emu->cpu.ime && (emu->cpu.int_enabled & emu->cpu.int_flags & ((1 << GB_INT_TOTAL) - 1)))
+        return 0;
+
+    if (emu->mmu.hdma_active && emu->gpu.mode == GB_GPU_MODE_HBLANK)
+        return 0;
+
+    /* Only addresses with an idle hint need the full check */
+    if (gb_speed_hacks_may_idle(&emu->hacks, emu->cpu.r.w[GB_REG_PC])
+        && gb_emu_is_idle_loop(emu, emu->cpu.r.w[GB_REG_PC]))
+        return 0;
+
+    return 1;
+}
+
+/* Reads the byte 'offset' bytes past PC without side effects, returning 0 for
+ * the I/O registers and OAM so they never match a pair */
+static inline uint8_t pair_peek(struct gb_emu *emu, int offset)
+{
+    uint16_t addr = emu->cpu.r.w[GB_REG_PC] + offset;
+
+    if (addr >= 0xFE00 && addr < 0xFF80)
+        return 0;
+
+    return gb_emu_read8(emu, addr);
+}
+
+/* Fetches the second opcode, which we already know */
+static inline void pair_next(struct gb_emu *emu)
+{
+    gb_emu_clock_tick(emu);
+    emu->cpu.r.w[GB_REG_PC]++;
+}
+
+/* LDI A, (HL)
+ * LD (DE), A */
+static int pair_ldi_a_hl_ld_de_a(struct gb_emu *emu)
+{
+    emu->cpu.r.b[GB_REG_A] = gb_emu_read8(emu, emu->cpu.r.w[GB_REG_HL]++);
+    gb_emu_clock_tick(emu);
+
+    if (!pair_can_continue(emu))
+        return 0;
+
+    pair_next(emu);
+
+    gb_emu_clock_tick(emu);
+    gb_emu_write8(emu, emu->cpu.r.w[GB_REG_DE], emu->cpu.r.b[GB_REG_A]);
+
+    return 8;
+}
+
+/* DEC reg
+ * JR NZ, n */
+static int pair_dec_jr_nz(struct gb_emu *emu, uint8_t opcode)
+{
+    uint8_t *reg = emu->cpu.r.b + gb_reg_map_8bit[(opcode & 0x38) >> 3];
+    uint8_t flags = (emu->cpu.r.b[GB_REG_F] & GB_FLAG_CARRY) | GB_FLAG_SUB;
+
+    if ((*reg & 0x0F) == 0)
+        flags |= GB_FLAG_HCARRY;
+
+    (*reg)--;
+
+    if (*reg == 0)
+        flags |= GB_FLAG_ZERO;
+
+    emu->cpu.r.b[GB_REG_F] = flags;
+
+    if (!pair_can_continue(emu))
+        return 0;
+
+    pair_next(emu);
+
+    return jp_rel_finish(emu, 0x20, *reg != 0) + 4;
+}
+
+/* CP n
+ * JR Z, n or JR NZ, n */
+static int pair_cp_jr(struct gb_emu *emu, uint8_t jr_opcode)
+{
+    uint8_t flags = GB_FLAG_SUB;
+    uint8_t tmp, a;
+
+    gb_emu_clock_tick(emu);
+    tmp = gb_emu_next_pc8(emu);
+    a = emu->cpu.r.b[GB_REG_A];
+
+    if (a == tmp)
+        flags |= GB_FLAG_ZERO;
+
+    if ((a & 0xF) < (tmp & 0xF))
+        flags |= GB_FLAG_HCARRY;
+
+    if (a < tmp)
+        flags |= GB_FLAG_CARRY;
+
+    emu->cpu.r.b[GB_REG_F] = flags;
+
+    if (!pair_can_continue(emu))
+        return 4;
+
+    pair_next(emu);
+
+    return jp_rel_finish(emu, jr_opcode, (jr_opcode == 0x28) == (a == tmp)) + 8;
+}
+
+/* LD A, (0xFF00 + n)
+ * AND n */
+static int pair_ldh_a_and(struct gb_emu *emu)
+{
+    uint8_t val;
+
+    gb_emu_clock_tick(emu);
+    val = gb_emu_read8(emu, 0xFF00 + gb_emu_next_pc8(emu));
+    gb_emu_clock_tick(emu);
+
+    emu->cpu.r.b[GB_REG_A] = val;
+
+    if (!pair_can_continue(emu))
+        return 4;
+
+    pair_next(emu);
+
+    gb_emu_clock_tick(emu);
+    val &= gb_emu_next_pc8(emu);
+
+    emu->cpu.r.b[GB_REG_A] = val;
+    emu->cpu.r.b[GB_REG_F] = GB_FLAG_HCARRY | (val? 0: GB_FLAG_ZERO);
+
+    return 12;
+}
+
+/* Runs 'opcode' along with the next instruction if they make up one of the
+ * pairs above. PC is just past 'opcode'.
+ *
+ * Returns the cycles used not counting the read of 'opcode', like
+ * gb_emu_run_inst(), or -1 if there is no pair here. */
+static int gb_emu_run_pair(struct gb_emu *emu, uint8_t opcode)
+{
+    uint8_t next;
+
+    /* The countdown after EI is done by gb_emu_run_inst(), so a pair can't
+     * run until it is over */
+    if (emu->cpu.int_count)
+        return -1;
+
+    switch (opcode) {
+    case 0x2A:
+        if (pair_peek(emu, 0) == 0x12)
+            return pair_ldi_a_hl_ld_de_a(emu);
+        break;
+
+    case 0x05: case 0x0D: case 0x15: case 0x1D:
+    case 0x25: case 0x2D: case 0x3D:
+        if (pair_peek(emu, 0) == 0x20)
+            return pair_dec_jr_nz(emu, opcode);
+        break;
+
+    case 0xFE:
+        next = pair_peek(emu, 1);
+        if (next == 0x20 || next == 0x28)
+            return pair_cp_jr(emu, next);
+        break;
+
+    case 0xF0:
+        if (pair_peek(emu, 1) == 0xE6)
+            return pair_ldh_a_and(emu);
+        break;
+    }
+
+    return -1;
+}
+
 int gb_emu_cpu_run_next_inst(struct gb_emu *emu)
 {
     int cycles = 0;
@@ -1678,6 +1930,12 @@ int gb_emu_cpu_run_next_inst(struct gb_emu *emu)
     if (gb_emu_hdma_check(emu))
         return cycles;
 
+    if (!emu->hook_flag && gb_emu_is_idle_loop(emu, emu->cpu.r.w[GB_REG_PC])) {
+        cycles += gb_emu_idle_skip(emu);
+        if (gb_emu_check_interrupt(emu))
+            goto inst_end;
+    }
+
     if (emu->hook_flag) {
         uint8_t bytes[3];
 
@@ -1692,9 +1950,17 @@ int gb_emu_cpu_run_next_inst(struct gb_emu *emu)
 
     gb_emu_clock_tick(emu);
     uint8_t opcode = gb_emu_next_pc8(emu);
+    int pair = -1;
+
+    /* Breakpoints and the hooks need to see every instruction */
+    if (!emu->hook_flag && !emu->break_flag)
+        pair = gb_emu_run_pair(emu, opcode);
 
     /* The extra four accounts for the read from PC above */
-    cycles = gb_emu_run_inst(emu, opcode) + 4;
+    if (pair == -1)
+        cycles += gb_emu_run_inst(emu, opcode) + 4;
+    else
+        cycles += pair + 4;
 
     if (emu->hook_flag)
         if (emu->cpu.hooks && emu->cpu.hooks->end_inst)
@@ -32,6 +32,9 @@ static void write_8bit_reg(struct gb_cpu_jit_context *ctx, int reg, jit_value_t
         gb_jit_clock_tick(ctx);
         jit_value_t hl = gb_jit_load_reg16(ctx, GB_REG_HL);
         gb_jit_write8(ctx, hl, val);
+
+        ctx->mbc_write = JIT_MBC_MAYBE;
+        ctx->mbc_addr = hl;
     } else {
         gb_jit_store_reg8(ctx, gb_reg_map_8bit[reg], val);
     }
@@ -168,12 +171,16 @@ static void load8_extra_a(struct gb_cpu_jit_context *ctx, uint8_t opcode)
             reg = GB_REG_BC;
 
         dest = gb_jit_load_reg16(ctx, reg);
+        ctx->mbc_write = JIT_MBC_MAYBE;
+        ctx->mbc_addr = dest;
         break;
 
     case 0xEA: /* LD (nn), A */
         gb_jit_clock_tick(ctx);
         gb_jit_clock_tick(ctx);
         dest = gb_jit_next_pc16(ctx);
+        if (gb_jit_fetch16(ctx->gb_emu, ctx->bank, ctx->addr) < 0x8000)
+            ctx->mbc_write = JIT_MBC_ALWAYS;
         ctx->addr += 2;
         break;
 
@@ -200,6 +207,8 @@ static void load8_extra_a(struct gb_cpu_jit_context *ctx, uint8_t opcode)
             gb_jit_store_reg16(ctx, GB_REG_HL,
                     jit_insn_add(ctx->func, dest, GB_JIT_CONST_USHORT(ctx->func, 1)));
         }
+        ctx->mbc_write = JIT_MBC_MAYBE;
+        ctx->mbc_addr = dest;
         break;
     }
 
@@ -298,6 +307,8 @@ static void load_mem_sp(struct gb_cpu_jit_context *ctx, uint8_t opcode)
     gb_jit_clock_tick(ctx);
     gb_jit_clock_tick(ctx);
     jit_value_t dest = gb_jit_next_pc16(ctx);
+    if (gb_jit_fetch16(ctx->gb_emu, ctx->bank, ctx->addr) < 0x8000)
+        ctx->mbc_write = JIT_MBC_ALWAYS;
     ctx->addr += 2;
 
     /* 16-bit write */
@@ -884,6 +895,23 @@ static void halt(struct gb_cpu_jit_context *ctx, uint8_t opcode)
     return ;
 }
 
+/*
+ * Emitted after HALT, which always ends a block. The registers have already
+ * been written back, so we wait in gb_emu_halt_skip() for an interrupt to wake
+ * the CPU, and then run the block for the interrupt vector directly rather
+ * then returning to the dispatcher first.
+ */
+static void gb_jit_halt(struct gb_cpu_jit_context *ctx)
+{
+    jit_value_t skip_args[] = { ctx->emu };
+    jit_value_t resume_args[] = { GB_JIT_CONST_PTR(ctx->func, ctx->dispatcher), ctx->emu };
+
+    jit_insn_call_native(ctx->func, "gb_emu_halt_skip", gb_emu_halt_skip, ctx->sigs->emu_void, skip_args, ARRAY_SIZE(skip_args), JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "gb_emu_dispatcher_resume", gb_emu_dispatcher_resume, ctx->sigs->ptr_ptr_void, resume_args, ARRAY_SIZE(resume_args), JIT_CALL_NOTHROW);
+
+    jit_insn_default_return(ctx->func);
+}
+
 /* STOP */
 static void stop(struct gb_cpu_jit_context *ctx, uint8_t opcode)
 {
@@ -1344,7 +1372,7 @@ static void z80_emu_run_cb_inst(struct gb_cpu_jit_context *ctx)
 
     gb_jit_clock_tick(ctx);
     gb_jit_next_pc8(ctx);
-    opcode = gb_emu_read8(ctx->gb_emu, ctx->addr);
+    opcode = gb_jit_fetch8(ctx->gb_emu, ctx->bank, ctx->addr);
     ctx->addr++;
 
     switch (opcode) {
@@ -1396,6 +1424,34 @@ static void check_int_count(struct gb_emu *emu)
     }
 }
 
+/*
+ * Called after an instruction that may have written to the MBC. Code in the
+ * switchable bank can't keep running after the bank changes, as the rest of
+ * the block may not be mapped anymore. Code in the fixed bank can, up until it
+ * runs into the switchable bank.
+ *
+ * Writes through a register only leave the block if the address was actually
+ * below 0x8000. Returns true if the block has to end here.
+ */
+static int jit_check_mbc_write(struct gb_cpu_jit_context *ctx)
+{
+    jit_label_t no_mbc = jit_label_undefined;
+
+    if (ctx->addr < GB_JIT_BANK_SIZE) {
+        ctx->bank_dirty = 1;
+        return 0;
+    }
+
+    if (ctx->mbc_write == JIT_MBC_ALWAYS)
+        return 1;
+
+    jit_insn_branch_if(ctx->func, jit_insn_ge(ctx->func, ctx->mbc_addr, GB_JIT_CONST_USHORT(ctx->func, 0x8000)), &no_mbc);
+    gb_emu_jit_func_exit(ctx);
+    jit_insn_label(ctx->func, &no_mbc);
+
+    return 0;
+}
+
 /* Returns true if instruction was a jump */
 int gb_emu_jit_run_inst(struct gb_cpu_jit_context *ctx, uint8_t opcode)
 {
@@ -1574,6 +1630,7 @@ int gb_emu_jit_run_inst(struct gb_cpu_jit_context *ctx, uint8_t opcode)
 
     case 0x76:
         halt(ctx, opcode);
+        jump = 1;
         break;
 
     case 0x10:
@@ -1667,11 +1724,8 @@ int gb_emu_jit_run_inst(struct gb_cpu_jit_context *ctx, uint8_t opcode)
     gb_jit_store_reg8(ctx, GB_REG_F, tmp);
 
     /* Check if we should enable interrupts */
-    jit_type_t params[] = { jit_type_void_ptr };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, ARRAY_SIZE(params), 1);
-
     jit_value_t args[] = { ctx->emu };
-    jit_insn_call_native(ctx->func, "check_int_count", check_int_count, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "check_int_count", check_int_count, ctx->sigs->emu_void, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 
     return jump;
 }
@@ -1679,74 +1733,59 @@ int gb_emu_jit_run_inst(struct gb_cpu_jit_context *ctx, uint8_t opcode)
 /* Returns true when we hit a jump - and the end of a block */
 int gb_emu_cpu_jit_run_next_inst(struct gb_cpu_jit_context *ctx)
 {
-    jit_type_t check_int_params[] = { jit_type_void_ptr };
-    jit_type_t check_int_signature = jit_type_create_signature(jit_abi_cdecl, jit_type_sys_int, check_int_params, ARRAY_SIZE(check_int_params), 1);
     jit_value_t check_int_args[] = { ctx->emu };
 
-    jit_type_t dispatch_params[] = { jit_type_void_ptr, jit_type_void_ptr };
-    jit_type_t dispatch_signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, dispatch_params, ARRAY_SIZE(dispatch_params), 1);
-    jit_value_t dispatch_args[] = { GB_JIT_CONST_PTR(ctx->func, ctx->dispatcher), ctx->emu };
     jit_value_t interrupt_check;
 
     jit_label_t inst_end = jit_label_undefined;
-    jit_label_t not_halted = jit_label_undefined;
     jit_label_t run_again = jit_label_undefined;
 
     jit_insn_label(ctx->func, &run_again);
 
-    jit_value_t halted = jit_insn_load_relative(ctx->func, ctx->emu, offsetof(struct gb_emu, cpu.halted), jit_type_ubyte);
-
-    /* When we're halted, we keep running the instruction again until we're not longer halted */
-    jit_insn_branch_if_not(ctx->func, halted, &not_halted);
-
-        /* When we're halted, the clock still ticks */
-        gb_jit_clock_tick(ctx);
-        interrupt_check = jit_insn_call_native(ctx->func, "gb_emu_check_interrupt", gb_emu_check_interrupt, check_int_signature, check_int_args, ARRAY_SIZE(check_int_args), JIT_CALL_NOTHROW);
-        jit_value_t halt_check_int = jit_insn_eq(ctx->func, interrupt_check, GB_JIT_CONST_INT(ctx->func, 0));
-
-        /* 
-         * FIXME: We currently return back to the dispatcher here and exit the JIT code. This works, but is not optimal.
-         */
-        jit_insn_branch_if(ctx->func, halt_check_int, &run_again);
-        gb_emu_jit_func_exit(ctx);
-        /* jit_insn_call_native(ctx->func, "gb_emu_run_dispatcher", gb_emu_run_dispatcher, dispatch_signature, dispatch_args, ARRAY_SIZE(dispatch_args), JIT_CALL_NOTHROW);
-        jit_insn_branch(ctx->func, &run_again); */
-    jit_insn_label(ctx->func, &not_halted);
-
-    jit_type_t hdma_check_params[] = { jit_type_void_ptr };
-    jit_type_t hdma_check_signature = jit_type_create_signature(jit_abi_cdecl, jit_type_sys_int, hdma_check_params, ARRAY_SIZE(hdma_check_params), 1);
-
     jit_value_t hdma_check_args[] = { ctx->emu };
-    jit_value_t hdma_check_flag = jit_insn_call_native(ctx->func, "gb_emu_hdma_check", gb_emu_hdma_check, hdma_check_signature, hdma_check_args, ARRAY_SIZE(hdma_check_args), JIT_CALL_NOTHROW);
+    jit_value_t hdma_check_flag = jit_insn_call_native(ctx->func, "gb_emu_hdma_check", gb_emu_hdma_check, ctx->sigs->emu_int, hdma_check_args, ARRAY_SIZE(hdma_check_args), JIT_CALL_NOTHROW);
 
     jit_insn_branch_if(ctx->func, hdma_check_flag, &run_again);
 
-    /* Insert hook_flag check */
-
     gb_jit_clock_tick(ctx);
 
     gb_jit_next_pc8(ctx);
-    uint8_t opcode = gb_emu_read8(ctx->gb_emu, ctx->addr);
+    uint8_t opcode = gb_jit_fetch8(ctx->gb_emu, ctx->bank, ctx->addr);
     ctx->addr++;
 
-    int jump = gb_emu_jit_run_inst(ctx, opcode);
+    ctx->mbc_write = JIT_MBC_NONE;
+    ctx->mbc_addr = NULL;
 
-    /* Insert hook_flag check here */
+    int jump = gb_emu_jit_run_inst(ctx, opcode);
 
     jit_insn_label(ctx->func, &inst_end);
 
-    interrupt_check = jit_insn_call_native(ctx->func, "gb_emu_check_interrupt", gb_emu_check_interrupt, check_int_signature, check_int_args, ARRAY_SIZE(check_int_args), JIT_CALL_NOTHROW);
+    /* gb_emu_check_interrupt() works on the registers in memory */
+    gb_emu_jit_func_flush_regs(ctx);
 
-    /* Insert break_flag hook here */
+    if (opcode == 0x76) {
+        gb_jit_halt(ctx);
+        return jump;
+    }
+
+    interrupt_check = jit_insn_call_native(ctx->func, "gb_emu_check_interrupt", gb_emu_check_interrupt, ctx->sigs->emu_int, check_int_args, ARRAY_SIZE(check_int_args), JIT_CALL_NOTHROW);
 
     jit_label_t dispatch_label = jit_label_undefined;
 
     jit_insn_branch_if(ctx->func, jit_insn_eq(ctx->func, interrupt_check, GB_JIT_CONST_INT(ctx->func, 0)), &dispatch_label);
     jit_insn_default_return(ctx->func);
-    /* jit_insn_call_native(ctx->func, "gb_emu_run_dispatcher", gb_emu_run_dispatcher, dispatch_signature, dispatch_args, ARRAY_SIZE(dispatch_args), JIT_CALL_NOTHROW); */
 
     jit_insn_label(ctx->func, &dispatch_label);
 
+    if (!jump && ctx->mbc_write != JIT_MBC_NONE)
+        jump = jit_check_mbc_write(ctx);
+
+    /* The bank the block was looked up under may not be the one mapped
+     * anymore, or was never checked if we started in the fixed bank, so we
+     * let the dispatcher look up the rest */
+    if (!jump && ctx->bank_dirty && ctx->addr >= GB_JIT_BANK_SIZE)
+        jump = 1;
+
     return jump;
 }
 
@@ -0,0 +1,284 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <jit/jit.h>
+
+#include "debug.h"
+#include "gb/disasm.h"
+#include "gb_internal.h"
+#include "gb/cpu.h"
+#include "cpu_internal.h"
+#include "cpu_jit_helpers.h"
+#include "cpu_dispatcher.h"
+
+/*
+ * Ahead-of-time compilation of the ROM.
+ *
+ * Before emulation starts, we walk the control flow graph of the ROM from the
+ * entry point, the interrupt vectors and the RST targets, using the opcode
+ * tables from the disassembler to find where each block ends. Every block we
+ * find is added to the dispatcher's table, and then they are all compiled
+ * across every core, each thread using its own libjit context and signatures.
+ *
+ * Code in the fixed bank can jump into the switchable bank, but which bank
+ * that is generally depends on state we don't know yet. We only follow those
+ * jumps when the block itself writes a constant bank number to the MBC with
+ * 'LD A, n' and 'LD (nn), A' first. Anything we miss is compiled by the
+ * dispatcher when it is first run, as before.
+ */
+
+struct aot_addr {
+    uint16_t addr;
+    int bank;
+};
+
+struct jit_aot {
+    struct cpu_dispatcher *dispatcher;
+    struct gb_emu *emu;
+
+    int rom_banks;
+
+    /* The bank mapped at 0x4000 when we start, which blocks in the fixed
+     * bank are recorded under - see gb_emu_dispatcher_get_block(). They
+     * end at 0x4000, so it's never compiled from. */
+    int start_bank;
+
+    struct aot_addr *queue;
+    int queue_len, queue_size;
+
+    struct jit_block **blocks;
+    int block_count, block_size;
+
+    /* Next entry in 'blocks' for the compile threads to take */
+    int next_block;
+};
+
+struct jit_aot_thread {
+    pthread_t thread;
+    struct jit_aot *aot;
+    struct gb_jit_compiler *compiler;
+};
+
+static const uint16_t jit_aot_roots[] = {
+    0x0100, /* Entry point */
+    0x0040, 0x0048, 0x0050, 0x0058, 0x0060, /* Interrupt vectors */
+    0x0000, 0x0008, 0x0010, 0x0018, 0x0020, 0x0028, 0x0030, 0x0038, /* RST */
+};
+
+static void jit_aot_push(struct jit_aot *aot, uint16_t addr, int bank)
+{
+    if (!gb_emu_addr_is_rom(aot->emu, addr))
+        return ;
+
+    if (aot->queue_len == aot->queue_size) {
+        aot->queue_size = aot->queue_size? aot->queue_size * 2: 64;
+        aot->queue = realloc(aot->queue, aot->queue_size * sizeof(*aot->queue));
+    }
+
+    aot->queue[aot->queue_len].addr = addr;
+    aot->queue[aot->queue_len].bank = (addr < GB_JIT_BANK_SIZE)? aot->start_bank: bank;
+    aot->queue_len++;
+}
+
+static void jit_aot_add_block(struct jit_aot *aot, struct jit_block *block)
+{
+    if (aot->block_count == aot->block_size) {
+        aot->block_size = aot->block_size? aot->block_size * 2: 64;
+        aot->blocks = realloc(aot->blocks, aot->block_size * sizeof(*aot->blocks));
+    }
+
+    aot->blocks[aot->block_count++] = block;
+}
+
+/* Converts a value written to the MBC's ROM bank register into the bank it
+ * selects. Only MBC5 can map bank 0 at 0x4000. */
+static int jit_aot_bank_select(struct jit_aot *aot, uint8_t val)
+{
+    int bank = val;
+
+    if (bank == 0 && aot->emu->mmu.mbc_controller != &gb_mbc5_mmu_entry)
+        bank = 1;
+
+    return bank % aot->rom_banks;
+}
+
+/*
+ * Finds the end of the block starting at 'start', in the same way the
+ * compiler does, and queues up every place it can go next.
+ */
+static void jit_aot_walk_block(struct jit_aot *aot, uint16_t start, int bank)
+{
+    struct gb_emu *emu = aot->emu;
+    uint16_t addr = start, taken, fallthrough;
+    int a_imm = -1, next_bank = -1;
+    uint8_t opcode;
+
+    while (1) {
+        struct opcode_format *format;
+
+        if (!gb_emu_addr_is_rom(emu, addr))
+            return ;
+
+        /* Blocks in the fixed bank end when they run into the switchable
+         * bank */
+        if (start < GB_JIT_BANK_SIZE && addr >= GB_JIT_BANK_SIZE) {
+            jit_aot_push(aot, addr, next_bank);
+            return ;
+        }
+
+        opcode = gb_jit_fetch8(emu, bank, addr);
+        format = opcode_decode_format_str + opcode;
+
+        if (format->is_jmp || opcode == 0x76)
+            break;
+
+        /* Track constant writes to the MBC's ROM bank register */
+        if (opcode == 0x3E) {
+            a_imm = gb_jit_fetch8(emu, bank, addr + 1);
+        } else if (opcode == 0xEA) {
+            uint16_t dest = gb_jit_fetch16(emu, bank, addr + 1);
+
+            if (dest >= 0x2000 && dest < 0x4000 && a_imm != -1)
+                next_bank = jit_aot_bank_select(aot, a_imm);
+
+            /* Blocks in the switchable bank end after writing to the MBC */
+            if (dest < 0x8000 && addr + 3 >= GB_JIT_BANK_SIZE) {
+                jit_aot_push(aot, addr + 3, (next_bank != -1)? next_bank: bank);
+                return ;
+            }
+        } else {
+            a_imm = -1;
+        }
+
+        if (opcode == 0xCB)
+            addr += 2;
+        else if (format->type == OPCODE_16BIT)
+            addr += 3;
+        else if (format->type == OPCODE_8BIT)
+            addr += 2;
+        else
+            addr++;
+    }
+
+    /* Code in the switchable bank stays in that bank unless it switches
+     * itself. Code in the fixed bank has no known bank to go to */
+    if (next_bank == -1 && start >= GB_JIT_BANK_SIZE)
+        next_bank = bank;
+
+    switch (gb_jit_branch_decode(emu, bank, addr, &taken, &fallthrough)) {
+    case JIT_BRANCH_COND:
+        jit_aot_push(aot, fallthrough, next_bank);
+        /* fall through */
+    case JIT_BRANCH_UNCOND:
+        if (taken < GB_JIT_BANK_SIZE || next_bank != -1)
+            jit_aot_push(aot, taken, next_bank);
+
+        /* CALL and RST come back to the next instruction */
+        if (opcode == 0xCD || (opcode & 0xC7) == 0xC7)
+            jit_aot_push(aot, fallthrough, next_bank);
+        break;
+
+    case JIT_BRANCH_NONE:
+        /* HALT and conditional RET continue on to the next instruction */
+        if (opcode == 0x76 || (opcode & 0xE7) == 0xC0)
+            jit_aot_push(aot, addr + 1, next_bank);
+        break;
+    }
+}
+
+static void jit_aot_walk(struct jit_aot *aot)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(jit_aot_roots); i++)
+        jit_aot_push(aot, jit_aot_roots[i], 0);
+
+    while (aot->queue_len) {
+        struct aot_addr next = aot->queue[--aot->queue_len];
+        struct jit_block **slot;
+
+        if (next.bank == -1)
+            continue;
+
+        slot = gb_emu_dispatcher_block_slot(aot->dispatcher, next.addr, next.bank);
+        if (*slot)
+            continue;
+
+        jit_aot_add_block(aot, gb_emu_dispatcher_new_block(aot->dispatcher, next.addr, next.bank));
+        jit_aot_walk_block(aot, next.addr, next.bank);
+    }
+}
+
+static void *jit_aot_thread_run(void *arg)
+{
+    struct jit_aot_thread *thread = arg;
+    struct jit_aot *aot = thread->aot;
+    int i;
+
+    while ((i = __sync_fetch_and_add(&aot->next_block, 1)) < aot->block_count)
+        gb_emu_dispatcher_compile_block(aot->dispatcher, thread->compiler, aot->emu, aot->blocks[i]);
+
+    return NULL;
+}
+
+void gb_emu_dispatcher_aot(struct cpu_dispatcher *dispatcher, struct gb_emu *emu)
+{
+    struct jit_aot aot;
+    struct jit_aot_thread *threads;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t start = gb_jit_time_ns();
+    int i, thread_count;
+
+    memset(&aot, 0, sizeof(aot));
+    aot.dispatcher = dispatcher;
+    aot.emu = emu;
+    aot.rom_banks = emu->rom.length / GB_JIT_BANK_SIZE;
+    aot.start_bank = emu->mmu.mbc_controller->get_bank(emu, GB_JIT_BANK_SIZE);
+
+    if (aot.rom_banks < 2)
+        aot.rom_banks = 2;
+
+    jit_aot_walk(&aot);
+
+    if (!aot.block_count) {
+        free(aot.queue);
+        return ;
+    }
+
+    thread_count = (cpus > 0)? cpus: 1;
+    if (thread_count > aot.block_count)
+        thread_count = aot.block_count;
+
+    threads = calloc(thread_count, sizeof(*threads));
+
+    dispatcher->aot_compilers = realloc(dispatcher->aot_compilers, (dispatcher->aot_compiler_count + thread_count) * sizeof(*dispatcher->aot_compilers));
+
+    for (i = 0; i < thread_count; i++) {
+        threads[i].aot = &aot;
+        threads[i].compiler = dispatcher->aot_compilers + dispatcher->aot_compiler_count++;
+        gb_jit_compiler_init(threads[i].compiler);
+
+        pthread_create(&threads[i].thread, NULL, jit_aot_thread_run, threads + i);
+    }
+
+    for (i = 0; i < thread_count; i++)
+        pthread_join(threads[i].thread, NULL);
+
+    /* Shown with --jit-stats */
+    dispatcher->stats.aot_blocks += aot.block_count;
+    dispatcher->stats.aot_threads += thread_count;
+    dispatcher->stats.aot_ns += gb_jit_time_ns() - start;
+
+    DEBUG_PRINTF("JIT: Compiled %d blocks ahead of time on %d threads\n", aot.block_count, thread_count);
+
+    free(threads);
+    free(aot.blocks);
+    free(aot.queue);
+}
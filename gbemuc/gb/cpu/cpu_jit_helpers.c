@@ -10,53 +10,153 @@
 
 #include "debug.h"
 #include "gb/disasm.h"
+#include "gb/bios.h"
 #include "gb_internal.h"
 #include "gb/cpu.h"
 #include "cpu_jit_helpers.h"
 
+void gb_jit_compiler_init(struct gb_jit_compiler *compiler)
+{
+    struct gb_jit_signatures *sigs = &compiler->sigs;
+    jit_type_t emu[] = { jit_type_void_ptr };
+    jit_type_t emu_addr[] = { jit_type_void_ptr, jit_type_ushort };
+    jit_type_t emu_addr_byte[] = { jit_type_void_ptr, jit_type_ushort, jit_type_ubyte };
+    jit_type_t emu_addr_word[] = { jit_type_void_ptr, jit_type_ushort, jit_type_ushort };
+    jit_type_t ptr_ptr[] = { jit_type_void_ptr, jit_type_void_ptr };
+
+    compiler->context = jit_context_create();
+
+    sigs->emu_void = jit_type_create_signature(jit_abi_cdecl, jit_type_void, emu, ARRAY_SIZE(emu), 1);
+    sigs->emu_int = jit_type_create_signature(jit_abi_cdecl, jit_type_sys_int, emu, ARRAY_SIZE(emu), 1);
+    sigs->read8 = jit_type_create_signature(jit_abi_cdecl, jit_type_ubyte, emu_addr, ARRAY_SIZE(emu_addr), 1);
+    sigs->write8 = jit_type_create_signature(jit_abi_cdecl, jit_type_void, emu_addr_byte, ARRAY_SIZE(emu_addr_byte), 1);
+    sigs->read16 = jit_type_create_signature(jit_abi_cdecl, jit_type_ushort, emu_addr, ARRAY_SIZE(emu_addr), 1);
+    sigs->write16 = jit_type_create_signature(jit_abi_cdecl, jit_type_void, emu_addr_word, ARRAY_SIZE(emu_addr_word), 1);
+    sigs->ptr_ptr_void = jit_type_create_signature(jit_abi_cdecl, jit_type_void, ptr_ptr, ARRAY_SIZE(ptr_ptr), 1);
+}
+
+void gb_jit_compiler_clear(struct gb_jit_compiler *compiler)
+{
+    struct gb_jit_signatures *sigs = &compiler->sigs;
+
+    jit_context_destroy(compiler->context);
+
+    jit_type_free(sigs->emu_void);
+    jit_type_free(sigs->emu_int);
+    jit_type_free(sigs->read8);
+    jit_type_free(sigs->write8);
+    jit_type_free(sigs->read16);
+    jit_type_free(sigs->write16);
+    jit_type_free(sigs->ptr_ptr_void);
+}
+
+/* Reads a byte of code straight from the ROM data for 'bank', rather then
+ * through the MMU. This doesn't depend on which bank is currently mapped, so
+ * code can be compiled for any bank, and from any thread.
+ *
+ * RAM code from the speed hacks is the exception, it is read through the MMU
+ * and only ever compiled by the dispatcher's thread. */
+uint8_t gb_jit_fetch8(struct gb_emu *emu, int bank, uint16_t addr)
+{
+    size_t offset = addr;
+
+    if (addr >= 0x8000)
+        return gb_emu_read8(emu, addr);
+
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios[addr];
+
+    if (addr >= 0x4000)
+        offset = (size_t)bank * 0x4000 + (addr & 0x3FFF);
+
+    if (offset >= emu->rom.length)
+        return 0xFF;
+
+    return emu->rom.data[offset];
+}
+
+uint16_t gb_jit_fetch16(struct gb_emu *emu, int bank, uint16_t addr)
+{
+    return gb_jit_fetch8(emu, bank, addr) | (gb_jit_fetch8(emu, bank, addr + 1) << 8);
+}
+
 void gb_jit_clock_tick(struct gb_cpu_jit_context *ctx)
 {
-    jit_type_t params[] = { jit_type_void_ptr };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, 1, 1);
+    jit_value_t args[] = { ctx->emu };
+    jit_insn_call_native(ctx->func, "gb_emu_clock_tick", gb_emu_clock_tick, ctx->sigs->emu_void, args, 1, JIT_CALL_NOTHROW);
+}
+
+static int gb_jit_rom_bank(struct gb_emu *emu)
+{
+    return emu->mmu.mbc_controller->get_bank(emu, 0x4000);
+}
 
+/* Leaves the function if the bank mapped at 0x4000 isn't the one the code is
+ * being compiled for */
+void gb_jit_bank_guard(struct gb_cpu_jit_context *ctx)
+{
+    jit_label_t same_bank = jit_label_undefined;
     jit_value_t args[] = { ctx->emu };
-    jit_insn_call_native(ctx->func, "gb_emu_clock_tick", gb_emu_clock_tick, signature, args, 1, JIT_CALL_NOTHROW);
+    jit_value_t bank = jit_insn_call_native(ctx->func, "gb_jit_rom_bank", gb_jit_rom_bank, ctx->sigs->emu_int, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+
+    jit_insn_branch_if(ctx->func, jit_insn_eq(ctx->func, bank, GB_JIT_CONST_INT(ctx->func, ctx->bank)), &same_bank);
+    gb_emu_jit_func_exit(ctx);
+    jit_insn_label(ctx->func, &same_bank);
 }
 
+#ifdef CONFIG_FASTMEM
+/* Reads from a readable fast memory page are a load from the mapped ROM, and
+ * everything else calls gb_emu_read8(). The mapping only goes stale after a
+ * write to the MBC, which also clears 'readable', so the slow path is what
+ * brings it back up to date. */
 jit_value_t gb_jit_read8(struct gb_cpu_jit_context *ctx, jit_value_t addr)
 {
-    jit_type_t params[] = { jit_type_void_ptr, jit_type_ushort };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_ubyte, params, ARRAY_SIZE(params), 1);
+    jit_label_t slow = jit_label_undefined, done = jit_label_undefined;
+    jit_value_t args[] = { ctx->emu, addr };
+    jit_value_t result = jit_value_create(ctx->func, jit_type_ubyte);
+    jit_value_t readable, page, base, val;
+
+    readable = jit_insn_load_relative(ctx->func, ctx->emu, offsetof(struct gb_emu, mmu.fastmem.readable), jit_type_ushort);
+    page = jit_insn_shr(ctx->func, addr, GB_JIT_CONST_UINT(ctx->func, 12));
+    readable = jit_insn_and(ctx->func, jit_insn_shr(ctx->func, readable, page), GB_JIT_CONST_UINT(ctx->func, 1));
+    jit_insn_branch_if_not(ctx->func, readable, &slow);
+
+    base = jit_insn_load_relative(ctx->func, ctx->emu, offsetof(struct gb_emu, mmu.fastmem.base), jit_type_void_ptr);
+    val = jit_insn_load_elem(ctx->func, base, addr, jit_type_ubyte);
+    jit_insn_store(ctx->func, result, val);
+    jit_insn_branch(ctx->func, &done);
 
+    jit_insn_label(ctx->func, &slow);
+    val = jit_insn_call_native(ctx->func, "gb_emu_read8", gb_emu_read8, ctx->sigs->read8, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    jit_insn_store(ctx->func, result, val);
+
+    jit_insn_label(ctx->func, &done);
+    return result;
+}
+#else
+jit_value_t gb_jit_read8(struct gb_cpu_jit_context *ctx, jit_value_t addr)
+{
     jit_value_t args[] = { ctx->emu, addr };
-    return jit_insn_call_native(ctx->func, "gb_emu_read8", gb_emu_read8, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    return jit_insn_call_native(ctx->func, "gb_emu_read8", gb_emu_read8, ctx->sigs->read8, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 }
+#endif
 
 void gb_jit_write8(struct gb_cpu_jit_context *ctx, jit_value_t addr, jit_value_t val)
 {
-    jit_type_t params[] = { jit_type_void_ptr, jit_type_ushort, jit_type_ubyte };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, ARRAY_SIZE(params), 1);
-
     jit_value_t args[] = { ctx->emu, addr, jit_insn_convert(ctx->func, val, jit_type_ubyte, 0) };
-    jit_insn_call_native(ctx->func, "gb_emu_write8", gb_emu_write8, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "gb_emu_write8", gb_emu_write8, ctx->sigs->write8, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 }
 
 jit_value_t gb_jit_read16(struct gb_cpu_jit_context *ctx, jit_value_t addr)
 {
-    jit_type_t params[] = { jit_type_void_ptr, jit_type_ushort };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_ushort, params, ARRAY_SIZE(params), 1);
-
     jit_value_t args[] = { ctx->emu, addr };
-    return jit_insn_call_native(ctx->func, "gb_emu_read16", gb_emu_read16, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    return jit_insn_call_native(ctx->func, "gb_emu_read16", gb_emu_read16, ctx->sigs->read16, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 }
 
 void gb_jit_write16(struct gb_cpu_jit_context *ctx, jit_value_t addr, jit_value_t val)
 {
-    jit_type_t params[] = { jit_type_void_ptr, jit_type_ushort, jit_type_ushort };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, ARRAY_SIZE(params), 1);
-
     jit_value_t args[] = { ctx->emu, addr, jit_insn_convert(ctx->func, val, jit_type_ushort, 0) };
-    jit_insn_call_native(ctx->func, "gb_emu_write16", gb_emu_write16, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "gb_emu_write16", gb_emu_write16, ctx->sigs->write16, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 }
 
 void gb_jit_set_flag(struct gb_cpu_jit_context *ctx, uint8_t flag)
@@ -205,12 +305,9 @@ static char buffer[4096];
 
 void gb_jit_dump_regs(struct gb_cpu_jit_context *ctx)
 {
-    jit_type_t params[] = { jit_type_void_ptr, jit_type_void_ptr };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, ARRAY_SIZE(params), 1);
-
     jit_value_t args[] = { ctx->emu, GB_JIT_CONST_PTR(ctx->func, buffer) };
 
-    jit_insn_call_native(ctx->func, "gb_emu_dump_regs", gb_emu_dump_regs, signature, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "gb_emu_dump_regs", gb_emu_dump_regs, ctx->sigs->ptr_ptr_void, args, ARRAY_SIZE(args), JIT_CALL_NOTHROW);
 
     gb_jit_printf(ctx, "%s", GB_JIT_CONST_PTR(ctx->func, buffer));
 }
@@ -234,11 +331,8 @@ static void disasm_next(struct gb_emu *emu)
 
 void gb_jit_disasm_next(struct gb_cpu_jit_context *ctx)
 {
-    jit_type_t params[] = { jit_type_void_ptr };
-    jit_type_t signature = jit_type_create_signature(jit_abi_cdecl, jit_type_void, params, 1, 1);
-
     jit_value_t args[] = { ctx->emu };
-    jit_insn_call_native(ctx->func, "disasm_next", disasm_next, signature, args, 1, JIT_CALL_NOTHROW);
+    jit_insn_call_native(ctx->func, "disasm_next", disasm_next, ctx->sigs->emu_void, args, 1, JIT_CALL_NOTHROW);
 }
 
 jit_value_t gb_jit_next_pc8(struct gb_cpu_jit_context *ctx)
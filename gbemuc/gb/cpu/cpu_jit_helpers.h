@@ -20,7 +20,14 @@
 
 #define GB_JIT_CONST_PTR(func, val) (jit_value_create_nint_constant((func), jit_type_void_ptr, (jit_nint)(val)))
 
+void gb_jit_compiler_init(struct gb_jit_compiler *compiler);
+void gb_jit_compiler_clear(struct gb_jit_compiler *compiler);
+
+uint8_t  gb_jit_fetch8(struct gb_emu *emu, int bank, uint16_t addr);
+uint16_t gb_jit_fetch16(struct gb_emu *emu, int bank, uint16_t addr);
+
 void gb_jit_clock_tick(struct gb_cpu_jit_context *ctx);
+void gb_jit_bank_guard(struct gb_cpu_jit_context *ctx);
 
 jit_value_t gb_jit_load_reg8(struct gb_cpu_jit_context *ctx, int reg);
 void        gb_jit_store_reg8(struct gb_cpu_jit_context *ctx, int reg, jit_value_t val);
@@ -0,0 +1,304 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jit/jit.h>
+
+#include "debug.h"
+#include "gb/disasm.h"
+#include "gb_internal.h"
+#include "gb/cpu.h"
+#include "cpu_internal.h"
+#include "cpu_dispatcher.h"
+
+/*
+ * Lockstep verification of the JIT against the interpreter.
+ *
+ * A shadow copy of the gb_emu is run through the interpreter alongside the
+ * real one, which runs through the JIT. After every block we run the shadow
+ * until it has used the same number of cycles, and then compare the two. The
+ * memory compare is limited to the pages written since the last check.
+ *
+ * The shadow can't share the APU with the real gb_emu, so the sound registers
+ * are disabled on both while verifying.
+ */
+
+struct jit_verify {
+    struct gb_emu *emu;
+    struct gb_emu shadow;
+    struct gb_gpu_display display;
+
+    uint8_t dirty_pages[256];
+    uint8_t shadow_dirty_pages[256];
+};
+
+static void jit_verify_disp_buf(struct gb_gpu_display *display, void *buf, const uint32_t *dirty_lines)
+{
+    /* The shadow's screen is never displayed */
+}
+
+/* The shadow sees whatever keys the real gb_emu read for this frame */
+static void jit_verify_get_keystate(struct gb_emu *shadow, struct gb_keypad *keys)
+{
+    struct jit_verify *verify = container_of(shadow, struct jit_verify, shadow);
+
+    *keys = verify->emu->gpu.keypad;
+}
+
+static void jit_verify_init(struct jit_verify *verify, struct gb_emu *emu)
+{
+    memset(verify, 0, sizeof(*verify));
+
+    /* Nothing can be half drawn when the shadow is copied */
+    gb_gpu_render_sync(&emu->gpu);
+
+    verify->emu = emu;
+    verify->shadow = *emu;
+
+    verify->display.disp_buf = jit_verify_disp_buf;
+    verify->display.get_keystate = jit_verify_get_keystate;
+    verify->display.dmg_theme = emu->gpu.display->dmg_theme;
+    verify->display.format = emu->gpu.display->format;
+
+    verify->shadow.gpu.display = &verify->display;
+    verify->shadow.sound.driver = NULL;
+    verify->shadow.rom.sav_filename = NULL;
+    verify->shadow.cpu.hooks = NULL;
+    verify->shadow.hook_flag = 0;
+    verify->shadow.break_flag = 0;
+    verify->shadow.breakpoint_count = 0;
+    verify->shadow.breakpoints = NULL;
+
+    /* The fetch pointer could point into the real gb_emu's WRAM */
+    gb_mmu_fetch_flush(&verify->shadow.mmu);
+
+#ifdef CONFIG_FASTMEM
+    /* The mapping belongs to the real gb_emu, the shadow reads through the MMU */
+    verify->shadow.mmu.fastmem.base = NULL;
+    verify->shadow.mmu.fastmem.rom_fd = -1;
+#endif
+
+#ifdef CONFIG_RENDER_THREAD
+    /* The shadow draws its lines as it reaches them */
+    verify->shadow.gpu.render_thread = NULL;
+#endif
+
+    /* Check the bulk copy and fill loops against running them normally */
+    verify->shadow.config.no_idioms = 1;
+
+    emu->sound.disabled = 1;
+    verify->shadow.sound.disabled = 1;
+
+    emu->mmu.dirty_pages = verify->dirty_pages;
+    verify->shadow.mmu.dirty_pages = verify->shadow_dirty_pages;
+}
+
+static void jit_verify_clear(struct jit_verify *verify)
+{
+    verify->emu->sound.disabled = 0;
+    verify->emu->mmu.dirty_pages = NULL;
+}
+
+/* Disassembles the block that started at 'addr', using the shadow's memory */
+static void jit_verify_dump_block(struct jit_verify *verify, uint16_t addr)
+{
+    int i, k;
+
+    printf("Block at 0x%04x:\n", addr);
+
+    for (i = 0; i < 32; i++) {
+        uint8_t bytes[3];
+        char buf[30] = { 0 };
+        int len;
+        struct opcode_format *format;
+
+        for (k = 0; k < 3; k++)
+            bytes[k] = gb_emu_read8(&verify->shadow, addr + k);
+
+        format = opcode_decode_format_str + bytes[0];
+
+        if (bytes[0] == 0xCB)
+            len = 2;
+        else if (format->type == OPCODE_16BIT)
+            len = 3;
+        else if (format->type == OPCODE_8BIT)
+            len = 2;
+        else
+            len = 1;
+
+        gb_disasm_inst(buf, bytes);
+        printf("  0x%04x: (0x%02x) %s\n", addr, bytes[0], buf);
+
+        if (format->is_jmp || bytes[0] == 0x76)
+            break;
+
+        addr += len;
+    }
+}
+
+/* Compares 'len' bytes of the backing memory of both instances, reporting the
+ * first byte that differs */
+static int jit_verify_mem(const char *name, int bank, uint16_t addr, const void *jit, const void *interp, size_t len)
+{
+    const uint8_t *j = jit, *in = interp;
+    size_t i;
+
+    if (memcmp(jit, interp, len) == 0)
+        return 0;
+
+    for (i = 0; i < len; i++)
+        if (j[i] != in[i])
+            break;
+
+    printf("Mismatch in %s bank %d at 0x%04zx: JIT 0x%02x, interpreter 0x%02x\n", name, bank, addr + i, j[i], in[i]);
+    return 1;
+}
+
+/* Compares the backing memory for the 256 byte page at 'page << 8', across
+ * every bank that could be mapped there */
+static int jit_verify_page(struct jit_verify *verify, int page)
+{
+    struct gb_emu *emu = verify->emu, *shadow = &verify->shadow;
+    uint16_t addr = page << 8;
+    int offset, bank;
+    int ret = 0;
+
+    switch (page) {
+    case 0x80 ... 0x9F:
+        offset = addr - 0x8000;
+        for (bank = 0; bank < 2; bank++)
+            ret |= jit_verify_mem("VRAM", bank, addr, emu->gpu.vram[bank].mem + offset, shadow->gpu.vram[bank].mem + offset, 256);
+        break;
+
+    case 0xA0 ... 0xBF:
+        offset = addr - 0xA000;
+        for (bank = 0; bank < ARRAY_SIZE(emu->mmu.eram); bank++)
+            ret |= jit_verify_mem("ERAM", bank, addr, emu->mmu.eram[bank] + offset, shadow->mmu.eram[bank] + offset, 256);
+        break;
+
+    case 0xC0 ... 0xCF:
+    case 0xE0 ... 0xEF:
+        offset = (addr - 0xC000) & 0x0FFF;
+        ret |= jit_verify_mem("WRAM", 0, addr, emu->mmu.wram[0] + offset, shadow->mmu.wram[0] + offset, 256);
+        break;
+
+    case 0xD0 ... 0xDF:
+    case 0xF0 ... 0xFD:
+        offset = (addr - 0xD000) & 0x0FFF;
+        for (bank = 1; bank < ARRAY_SIZE(emu->mmu.wram); bank++)
+            ret |= jit_verify_mem("WRAM", bank, addr, emu->mmu.wram[bank] + offset, shadow->mmu.wram[bank] + offset, 256);
+        break;
+
+    case 0xFF:
+        ret |= jit_verify_mem("ZRAM", 0, 0xFF80, emu->mmu.zram, shadow->mmu.zram, sizeof(emu->mmu.zram));
+        break;
+    }
+
+    return ret;
+}
+
+#define VERIFY_FIELD(name, field) \
+    do { \
+        if (emu->field != shadow->field) { \
+            printf("Mismatch in %s: JIT 0x%llx, interpreter 0x%llx\n", (name), \
+                    (unsigned long long)emu->field, (unsigned long long)shadow->field); \
+            ret = 1; \
+        } \
+    } while (0)
+
+/* Returns true if the two instances don't match */
+static int jit_verify_compare(struct jit_verify *verify)
+{
+    struct gb_emu *emu = verify->emu, *shadow = &verify->shadow;
+    int ret = 0;
+    int i;
+
+    VERIFY_FIELD("AF", cpu.r.w[GB_REG_AF]);
+    VERIFY_FIELD("BC", cpu.r.w[GB_REG_BC]);
+    VERIFY_FIELD("DE", cpu.r.w[GB_REG_DE]);
+    VERIFY_FIELD("HL", cpu.r.w[GB_REG_HL]);
+    VERIFY_FIELD("SP", cpu.r.w[GB_REG_SP]);
+    VERIFY_FIELD("PC", cpu.r.w[GB_REG_PC]);
+    VERIFY_FIELD("cycles", cpu.cycles);
+    VERIFY_FIELD("halted", cpu.halted);
+    VERIFY_FIELD("IME", cpu.ime);
+    VERIFY_FIELD("int count", cpu.int_count);
+    VERIFY_FIELD("IE", cpu.int_enabled);
+    VERIFY_FIELD("IF", cpu.int_flags);
+    VERIFY_FIELD("double speed", cpu.double_speed);
+    VERIFY_FIELD("GPU mode", gpu.mode);
+    VERIFY_FIELD("GPU clock", gpu.clock);
+    VERIFY_FIELD("LY", gpu.cur_line);
+    VERIFY_FIELD("DIV", timer.div);
+    VERIFY_FIELD("TIMA", timer.tima);
+    VERIFY_FIELD("WRAM bank", mmu.cgb_wram_bank_no);
+    VERIFY_FIELD("VRAM bank", gpu.cgb_vram_bank_no);
+
+    if (emu->mmu.mbc_controller->get_bank(emu, 0x4000) != shadow->mmu.mbc_controller->get_bank(shadow, 0x4000)) {
+        printf("Mismatch in ROM bank\n");
+        ret = 1;
+    }
+
+    ret |= jit_verify_mem("OAM", 0, 0xFE00, emu->gpu.oam.mem, shadow->gpu.oam.mem, sizeof(emu->gpu.oam.mem));
+
+    for (i = 0; i < 256; i++) {
+        if (!verify->dirty_pages[i] && !verify->shadow_dirty_pages[i])
+            continue;
+
+        ret |= jit_verify_page(verify, i);
+    }
+
+    memset(verify->dirty_pages, 0, sizeof(verify->dirty_pages));
+    memset(verify->shadow_dirty_pages, 0, sizeof(verify->shadow_dirty_pages));
+
+    return ret;
+}
+
+void gb_emu_run_jit_verify(struct gb_emu *emu)
+{
+    struct cpu_dispatcher *dispatcher = malloc(sizeof(*dispatcher));
+    struct jit_verify *verify = malloc(sizeof(*verify));
+
+    gb_emu_cpu_dispatcher_init(dispatcher);
+    jit_verify_init(verify, emu);
+
+    if (emu->config.jit_aot)
+        gb_emu_dispatcher_aot(dispatcher, emu);
+
+    while (!emu->stop_emu) {
+        uint16_t block_addr = emu->cpu.r.w[GB_REG_PC];
+
+        gb_emu_dispatcher_step(dispatcher, emu);
+
+        while (verify->shadow.cpu.cycles < emu->cpu.cycles)
+            gb_emu_cpu_run_next_inst(&verify->shadow);
+
+        if (jit_verify_compare(verify)) {
+            char reg_buf[263];
+
+            jit_verify_dump_block(verify, block_addr);
+
+            gb_emu_dump_regs(emu, reg_buf);
+            printf("JIT:\n%s", reg_buf);
+
+            gb_emu_dump_regs(&verify->shadow, reg_buf);
+            printf("Interpreter:\n%s", reg_buf);
+
+            emu->stop_emu = 1;
+            emu->reason = GB_EMU_BREAK;
+        }
+    }
+
+    if (emu->config.jit_stats)
+        gb_emu_dispatcher_print_stats(dispatcher, stdout);
+
+    jit_verify_clear(verify);
+    gb_emu_cpu_dispatcher_clear(dispatcher);
+
+    free(verify);
+    free(dispatcher);
+}
@@ -17,6 +17,9 @@
 
 struct gb_debugger {
     int exit_flag;
+
+    /* Used for the 'run' command */
+    enum gb_cpu_type cpu_type;
 };
 
 static struct cmd_desc debugger_cmds[];
@@ -40,6 +43,22 @@ static void debugger_breakpoint(int argc, char **argv, va_list args)
     gb_emu_add_breakpoint(emu, addr);
 }
 
+static void debugger_breakpoint_del(int argc, char **argv, va_list args)
+{
+    struct gb_debugger *__unused debugger = va_arg(args, struct gb_debugger *);
+    struct gb_emu *emu = va_arg(args, struct gb_emu *);
+    int id;
+
+    if (argc != 1) {
+        printf("Please supply a breakpoint number\n");
+        return;
+    }
+
+    sscanf(argv[0], "%i", &id);
+
+    gb_emu_del_breakpoint(emu, id - 1);
+}
+
 static void debugger_breakpoint_on(int argc, char **argv, va_list args)
 {
     struct gb_debugger *__unused debugger = va_arg(args, struct gb_debugger *);
@@ -58,11 +77,11 @@ static void debugger_breakpoint_off(int argc, char **argv, va_list args)
 
 static void debugger_run(int argc, char **argv, va_list args)
 {
-    struct gb_debugger *__unused debugger = va_arg(args, struct gb_debugger *);
+    struct gb_debugger *debugger = va_arg(args, struct gb_debugger *);
     struct gb_emu *emu = va_arg(args, struct gb_emu *);
     enum gb_emu_stop result;
 
-    result = gb_run(emu, GB_CPU_INTERPRETER);
+    result = gb_run(emu, debugger->cpu_type);
 
     if (result == GB_EMU_STOP)
         printf("PC: 0x%04x\n", emu->cpu.r.w[GB_REG_PC]);
@@ -164,6 +183,16 @@ static void display_tile(struct gb_gpu *gpu, int spriten, union gb_gpu_color_u *
     }
 }
 
+/* The tiles are drawn with the DMG theme's colors */
+static int debugger_can_display_tiles(struct gb_gpu *gpu)
+{
+    if (gpu->display->format == GB_GPU_FORMAT_ARGB8888)
+        return 1;
+
+    printf("Tiles can only be shown on an ARGB8888 display\n");
+    return 0;
+}
+
 static void debugger_show_tiles(int argc, char **argv, va_list args)
 {
     struct gb_debugger *__unused debugger = va_arg(args, struct gb_debugger *);
@@ -172,6 +201,9 @@ static void debugger_show_tiles(int argc, char **argv, va_list args)
     union gb_gpu_color_u screenbuf[GB_SCREEN_HEIGHT * GB_SCREEN_WIDTH] = { 0 };
     int spriten = 0, soff = 0;
 
+    if (!debugger_can_display_tiles(gpu))
+        return ;
+
     for (spriten = 0; spriten < 20 * 18; spriten++) {
         int x, y;
         x = (spriten / 20) * 8;
@@ -180,7 +212,9 @@ static void debugger_show_tiles(int argc, char **argv, va_list args)
         display_tile(gpu, spriten + soff, screenbuf, x, y);
     }
 
-    (gpu->display->disp_buf) (gpu->display, screenbuf);
+    gb_gpu_render_sync(gpu);
+    (gpu->display->disp_buf) (gpu->display, screenbuf, NULL);
+    gb_gpu_mark_all_dirty(gpu);
 }
 
 static void debugger_show_sprites(int argc, char **argv, va_list args)
@@ -191,6 +225,9 @@ static void debugger_show_sprites(int argc, char **argv, va_list args)
     union gb_gpu_color_u screenbuf[GB_SCREEN_HEIGHT * GB_SCREEN_WIDTH] = { 0 };
     int spriten = 0;
 
+    if (!debugger_can_display_tiles(gpu))
+        return ;
+
     for (spriten = 0; spriten < 40; spriten++) {
         int tile_no = emu->gpu.oam.s_attrs[spriten][GB_GPU_SPRITE_ATTR_TILE_NUM];
         int x, y;
@@ -201,7 +238,9 @@ static void debugger_show_sprites(int argc, char **argv, va_list args)
         display_tile(gpu, tile_no, screenbuf, x, y);
     }
 
-    (gpu->display->disp_buf) (gpu->display, screenbuf);
+    gb_gpu_render_sync(gpu);
+    (gpu->display->disp_buf) (gpu->display, screenbuf, NULL);
+    gb_gpu_mark_all_dirty(gpu);
 }
 
 static void debugger_show_palettes(int argc, char **argv, va_list args)
@@ -219,6 +258,9 @@ static struct cmd_desc debugger_cmds[] = {
     { 'b', "breakpoint", debugger_breakpoint,
         "Set a breakpoint at an address",
         "<addr>" },
+    { '\0', "breakpoint-del", debugger_breakpoint_del,
+        "Delete a breakpoint",
+        "<num>" },
     { '\0', "breakpoint-on", debugger_breakpoint_on,
         "Turn on breakpoints",
         NULL },
@@ -285,7 +327,7 @@ static void debugger_print_end_inst(struct gb_cpu_hooks *hooks, struct gb_emu *e
 static struct gb_cpu_hooks debugger_cpu_hooks = { .next_inst = debugger_print_next_inst,
                                                   .end_inst  = debugger_print_end_inst };
 
-void gb_debugger_run(struct gb_emu *emu)
+void gb_debugger_run(struct gb_emu *emu, enum gb_cpu_type cpu_type)
 {
     struct gb_debugger debugger;
     int cur_buff = 0;
@@ -294,6 +336,7 @@ void gb_debugger_run(struct gb_emu *emu)
     char *line[2] = { NULL, NULL };
 
     memset(&debugger, 0, sizeof(debugger));
+    debugger.cpu_type = cpu_type;
 
     emu->cpu.hooks = &debugger_cpu_hooks;
 
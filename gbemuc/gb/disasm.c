@@ -54,7 +54,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("DEC D"),
     OP_FORM_ONE ("LD D, 0x%02x"),
     OP_FORM_NONE("RLA"),
-    OP_FORM_ONE ("JR 0x%02x"),
+    OP_FORM_JMP_ONE ("JR 0x%02x"),
     OP_FORM_NONE("ADD HL, DE"),
     OP_FORM_NONE("LD A, (DE)"),
     OP_FORM_NONE("DEC DE"),
@@ -64,7 +64,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("RRA"),
 
     [0x20] =
-    OP_FORM_ONE ("JR NZ, 0x%02x"),
+    OP_FORM_JMP_ONE ("JR NZ, 0x%02x"),
     OP_FORM_16  ("LD HL, 0x%04x"),
     OP_FORM_NONE("LD (HL+), A"),
     OP_FORM_NONE("INC HL"),
@@ -72,7 +72,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("DEC H"),
     OP_FORM_ONE ("LD H, 0x%02x"),
     OP_FORM_NONE("DAA"),
-    OP_FORM_ONE ("JR Z, 0x%02x"),
+    OP_FORM_JMP_ONE ("JR Z, 0x%02x"),
     OP_FORM_NONE("ADD HL, HL"),
     OP_FORM_NONE("LD A, (HL+)"),
     OP_FORM_NONE("DEC HL"),
@@ -82,7 +82,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("CPL"),
 
     [0x30] =
-    OP_FORM_ONE ("JR NC, 0x%02x"),
+    OP_FORM_JMP_ONE ("JR NC, 0x%02x"),
     OP_FORM_16  ("LD SP, 0x%04x"),
     OP_FORM_NONE("LD (HL-), A"),
     OP_FORM_NONE("INC SP"),
@@ -90,7 +90,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("DEC (HL)"),
     OP_FORM_ONE ("LD (HL), 0x%02x"),
     OP_FORM_NONE("SCF"),
-    OP_FORM_ONE ("JR C, 0x%02x"),
+    OP_FORM_JMP_ONE ("JR C, 0x%02x"),
     OP_FORM_NONE("ADD HL, SP"),
     OP_FORM_NONE("LD A, (HL-)"),
     OP_FORM_NONE("DEC SP"),
@@ -244,40 +244,40 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE("CP A"),
 
     [0xC0] =
-    OP_FORM_NONE("RET NZ"),
+    OP_FORM_JMP_NONE("RET NZ"),
     OP_FORM_NONE("POP BC"),
-    OP_FORM_16  ("JP NZ, 0x%04x"),
-    OP_FORM_16  ("JP 0x%04x"),
-    OP_FORM_16  ("CALL NZ, 0x%04x"),
+    OP_FORM_JMP_16  ("JP NZ, 0x%04x"),
+    OP_FORM_JMP_16  ("JP 0x%04x"),
+    OP_FORM_JMP_16  ("CALL NZ, 0x%04x"),
     OP_FORM_NONE("PUSH BC"),
     OP_FORM_ONE ("ADD A, 0x%02x"),
-    OP_FORM_NONE("RST 0x00"),
-    OP_FORM_NONE("RET Z"),
-    OP_FORM_NONE("RET"),
-    OP_FORM_16  ("JP Z, 0x%04x"),
+    OP_FORM_JMP_NONE("RST 0x00"),
+    OP_FORM_JMP_NONE("RET Z"),
+    OP_FORM_JMP_NONE("RET"),
+    OP_FORM_JMP_16  ("JP Z, 0x%04x"),
     OP_FORM_NONE("CB"),
-    OP_FORM_16  ("CALL Z, 0x%04x"),
-    OP_FORM_16  ("CALL 0x%04x"),
+    OP_FORM_JMP_16  ("CALL Z, 0x%04x"),
+    OP_FORM_JMP_16  ("CALL 0x%04x"),
     OP_FORM_ONE ("ADC A, 0x%02x"),
-    OP_FORM_NONE("RST 0x08"),
+    OP_FORM_JMP_NONE("RST 0x08"),
 
     [0xD0] =
-    OP_FORM_NONE("RET NC"),
+    OP_FORM_JMP_NONE("RET NC"),
     OP_FORM_NONE("POP DE"),
-    OP_FORM_16  ("JP NC, 0x%04x"),
+    OP_FORM_JMP_16  ("JP NC, 0x%04x"),
     OP_FORM_NONE(""),
-    OP_FORM_16  ("CALL NC, 0x%04x"),
+    OP_FORM_JMP_16  ("CALL NC, 0x%04x"),
     OP_FORM_NONE("PUSH DE"),
     OP_FORM_ONE ("SUB 0x%02x"),
-    OP_FORM_NONE("RST 0x10"),
-    OP_FORM_NONE("RET C"),
-    OP_FORM_NONE("RETI"),
-    OP_FORM_16  ("JP C, 0x%04x"),
+    OP_FORM_JMP_NONE("RST 0x10"),
+    OP_FORM_JMP_NONE("RET C"),
+    OP_FORM_JMP_NONE("RETI"),
+    OP_FORM_JMP_16  ("JP C, 0x%04x"),
     OP_FORM_NONE(""),
-    OP_FORM_16  ("CALL C, 0x%04x"),
+    OP_FORM_JMP_16  ("CALL C, 0x%04x"),
     OP_FORM_NONE(""),
     OP_FORM_ONE ("SBC A, 0x%02x"),
-    OP_FORM_NONE("RST 0x18"),
+    OP_FORM_JMP_NONE("RST 0x18"),
 
     [0xE0] =
     OP_FORM_ONE ("LD (0x00FF + 0x%02x), A"),
@@ -287,15 +287,15 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE(""),
     OP_FORM_NONE("PUSH HL"),
     OP_FORM_ONE ("AND 0x%02x"),
-    OP_FORM_NONE("RST 0x20"),
+    OP_FORM_JMP_NONE("RST 0x20"),
     OP_FORM_ONE ("AND SP, 0x%02x"),
-    OP_FORM_NONE("JP (HL)"),
+    OP_FORM_JMP_NONE("JP (HL)"),
     OP_FORM_16  ("LD (0x%04x), A"),
     OP_FORM_NONE(""),
     OP_FORM_NONE(""),
     OP_FORM_NONE(""),
     OP_FORM_ONE ("XOR 0x%02x"),
-    OP_FORM_NONE("RST 0x28"),
+    OP_FORM_JMP_NONE("RST 0x28"),
 
     [0xF0] =
     OP_FORM_ONE ("LD A, (0x00FF + 0x%02x)"),
@@ -305,7 +305,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE(""),
     OP_FORM_NONE("PUSH AF"),
     OP_FORM_ONE ("OR 0x%02x"),
-    OP_FORM_NONE("RST 0x30"),
+    OP_FORM_JMP_NONE("RST 0x30"),
     OP_FORM_ONE ("LD HL, SP + 0x%02x"),
     OP_FORM_NONE("LD SP, HL"),
     OP_FORM_16  ("LD A, (0x%04x"),
@@ -313,7 +313,7 @@ struct opcode_format opcode_decode_format_str[256] = {
     OP_FORM_NONE(""),
     OP_FORM_NONE(""),
     OP_FORM_ONE ("CP 0x%02x"),
-    OP_FORM_NONE("RST 0x38"),
+    OP_FORM_JMP_NONE("RST 0x38"),
 };
 
 static struct opcode_format opcode_cb_decode_format_str[256] = {
@@ -616,7 +616,7 @@ void gb_disasm_inst(char *buf, uint8_t *bytes)
     if (opcode != 0xCB)
         format = opcode_decode_format_str + opcode;
     else
-        format = opcode_cb_decode_format_str + opcode;
+        format = opcode_cb_decode_format_str + bytes[1];
 
     switch (format->type) {
     case OPCODE_NONE:
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -18,6 +19,10 @@
 #include "debug.h"
 #include "cpu/cpu_internal.h"
 
+#ifdef CONFIG_RENDER_THREAD
+# include "gb/render_thread.h"
+#endif
+
 void gb_emu_rom_open(struct gb_emu *emu, const char *filename)
 {
     int cart_bitmap;
@@ -26,6 +31,9 @@ void gb_emu_rom_open(struct gb_emu *emu, const char *filename)
 
     gb_rom_open(&emu->rom, filename);
 
+    if (gb_speed_hacks_load(&emu->hacks, emu->config.speed_hacks_file, &emu->rom) == -1)
+        printf("Unable to read speed hacks from %s\n", emu->config.speed_hacks_file);
+
     if (emu->rom.sav_filename) {
         struct stat s;
 
@@ -88,6 +96,10 @@ void gb_emu_rom_open(struct gb_emu *emu, const char *filename)
 
     if (f)
         fclose(f);
+
+#ifdef CONFIG_FASTMEM
+    gb_fastmem_init(emu);
+#endif
 }
 
 void gb_emu_add_breakpoint(struct gb_emu *emu, uint16_t addr)
@@ -96,11 +108,18 @@ void gb_emu_add_breakpoint(struct gb_emu *emu, uint16_t addr)
 
     emu->breakpoints = realloc(emu->breakpoints, emu->breakpoint_count * sizeof(*emu->breakpoints));
     emu->breakpoints[emu->breakpoint_count - 1] = addr;
+    emu->breakpoint_gen++;
 }
 
+/* 'id' is the index into the breakpoint list */
 void gb_emu_del_breakpoint(struct gb_emu *emu, int id)
 {
+    if (id < 0 || id >= emu->breakpoint_count)
+        return ;
 
+    memmove(emu->breakpoints + id, emu->breakpoints + id + 1, (emu->breakpoint_count - id - 1) * sizeof(*emu->breakpoints));
+    emu->breakpoint_count--;
+    emu->breakpoint_gen++;
 }
 
 void gb_emu_init(struct gb_emu *emu)
@@ -114,6 +133,11 @@ void gb_emu_init(struct gb_emu *emu)
 
 void gb_emu_reset(struct gb_emu *emu)
 {
+#ifdef CONFIG_RENDER_THREAD
+    if (emu->config.render_thread)
+        gb_render_thread_start(emu);
+#endif
+
     gb_emu_io_reset(emu);
 
     emu->cpu.ime = 0;
@@ -121,6 +145,7 @@ void gb_emu_reset(struct gb_emu *emu)
     emu->cpu.r.w[GB_REG_PC] = 0x0100;
     emu->cpu.r.w[GB_REG_SP] = 0xFFFE;
     emu->mmu.bios_flag = 1;
+    gb_mmu_fetch_flush(&emu->mmu);
 
     if (gb_emu_is_cgb(emu))
         emu->cpu.r.b[GB_REG_A] = 0x11;
@@ -137,10 +162,16 @@ void gb_emu_set_display(struct gb_emu *emu, struct gb_gpu_display *display)
         { .i_color = 0xFF000000 },
     };
 
+    gb_gpu_render_sync(&emu->gpu);
+
     emu->gpu.display = display;
     if (!display)
         return ;
 
+    gb_gpu_set_format(&emu->gpu, display->format);
+    gb_gpu_palettes_flush(&emu->gpu);
+    display->palette = emu->gpu.palette_colors;
+
     if (cgb_find_theme(&display->dmg_theme, emu->rom.title, emu->rom.title_chksum)) {
         printf("Using theme: 0x%02x\n", emu->rom.title_chksum);
     } else {
@@ -161,7 +192,12 @@ void gb_emu_set_sound(struct gb_emu *emu, struct gb_apu_sound *sound)
 
 void gb_emu_write_save(struct gb_emu *emu)
 {
-    FILE *f = fopen(emu->rom.sav_filename, "w+");
+    FILE *f;
+
+    if (!emu->rom.sav_filename)
+        return ;
+
+    f = fopen(emu->rom.sav_filename, "w+");
 
     printf("Writing .sav file: %zd bytes\n", gb_ram_size[emu->rom.ram_size] * 1024);
     printf("sav_file: %s\n", emu->rom.sav_filename);
@@ -186,9 +222,17 @@ void gb_emu_write_save(struct gb_emu *emu)
 
 void gb_emu_clear(struct gb_emu *emu)
 {
+#ifdef CONFIG_RENDER_THREAD
+    gb_render_thread_stop(emu);
+#endif
+
     if (emu->rom.sav_filename)
         gb_emu_write_save(emu);
 
+#ifdef CONFIG_FASTMEM
+    gb_fastmem_clear(&emu->mmu.fastmem);
+#endif
+
     gb_rom_clear(&emu->rom);
     gb_sound_clear(&emu->sound);
 
@@ -231,6 +275,10 @@ enum gb_emu_stop gb_run(struct gb_emu *emu, enum gb_cpu_type cpu_type)
     case GB_CPU_JIT:
         gb_emu_run_jit(emu);
         break;
+
+    case GB_CPU_JIT_VERIFY:
+        gb_emu_run_jit_verify(emu);
+        break;
     }
 
     sigaction(SIGINT, &old_act, NULL);
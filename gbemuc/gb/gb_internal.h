@@ -5,13 +5,8 @@
 
 struct gb_emu;
 
-static inline void gb_emu_clock_tick(struct gb_emu *emu)
+static inline void gb_emu_sound_cycles(struct gb_emu *emu, int cycles)
 {
-    int cycles = emu->cpu.double_speed? 2: 4;
-
-    gb_emu_gpu_tick(emu, cycles);
-    gb_timer_ticks(emu, cycles);
-
     emu->sound.apu_cycles += cycles;
 
     if (emu->sound.apu_cycles > 72000) {
@@ -27,4 +22,55 @@ static inline void gb_emu_clock_tick(struct gb_emu *emu)
     }
 }
 
+static inline void gb_emu_clock_tick(struct gb_emu *emu)
+{
+    int cycles = emu->cpu.double_speed? 2: 4;
+
+    emu->cpu.cycles += cycles;
+
+    gb_emu_gpu_tick(emu, cycles);
+    gb_timer_ticks(emu, cycles);
+
+    gb_emu_sound_cycles(emu, cycles);
+}
+
+/* Returns the number of cycles the clock can be advanced by before the next
+ * GPU or timer event - the only places an interrupt flag can become set
+ * without the CPU doing anything.
+ *
+ * The result is always a whole number of ticks. In double speed mode the GPU
+ * and timer don't scale the same way, so we never step more then one tick. */
+static inline int gb_emu_clock_event_cycles(struct gb_emu *emu)
+{
+    int gpu, timer, cycles;
+
+    if (emu->cpu.double_speed)
+        return 2;
+
+    gpu = gb_gpu_event_cycles(&emu->gpu);
+    timer = gb_timer_event_cycles(&emu->timer);
+
+    cycles = (gpu < timer)? gpu: timer;
+
+    return (cycles + 3) & ~3;
+}
+
+/* Advances the clock by 'cycles' in one step, which must be no more then
+ * gb_emu_clock_event_cycles(). The result is identical to calling
+ * gb_emu_clock_tick() repeatedly. */
+static inline void gb_emu_clock_advance(struct gb_emu *emu, int cycles)
+{
+    if (cycles <= 4) {
+        gb_emu_clock_tick(emu);
+        return ;
+    }
+
+    emu->cpu.cycles += cycles;
+
+    gb_emu_gpu_tick(emu, cycles);
+    gb_timer_ticks(emu, cycles);
+
+    gb_emu_sound_cycles(emu, cycles);
+}
+
 #endif
@@ -4,12 +4,17 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "gb/cpu.h"
 #include "gb/gpu.h"
 #include "gb.h"
 #include "debug.h"
 
+#ifdef CONFIG_RENDER_THREAD
+# include "gb/render_thread.h"
+#endif
+
 union gb_gpu_color_u gb_colors[][4] = {
     {
         { .i_color = 0xFFFFF77B },
@@ -48,137 +53,260 @@ static uint32_t make_cgb_argb_color(uint16_t old_color, int use_real_colors)
     return col;
 }
 
-static void render_background_tile(struct gb_emu *emu, struct gb_gpu *gpu, union gb_gpu_color_u *line,
-        uint8_t *bkgd_tiles, uint8_t *bkgd_attributes, int x_pix, int y_pix, int tile_offset_byte)
+static uint16_t make_rgb565_color(uint32_t argb)
+{
+    return (((argb >> 19) & 0x1F) << 11) | (((argb >> 10) & 0x3F) << 5) | ((argb >> 3) & 0x1F);
+}
+
+/* The shade of a CGB color, from its brightness */
+static uint8_t make_shade(uint32_t argb)
+{
+    int luma = ((argb >> 16) & 0xFF) * 77 + ((argb >> 8) & 0xFF) * 150 + (argb & 0xFF) * 29;
+
+    return 3 - (luma >> 14);
+}
+
+static void update_palettes(struct gb_emu *emu, struct gb_gpu *gpu)
 {
-    uint8_t c, pal_col;
-    uint8_t lo, hi;
-    int sprite;
-    uint8_t attr;
-    uint8_t tile_index;
-    int x_flip = 0, y_flip = 0, vbank = 0, priority = 0, cgb_palette = 0;
+    union gb_gpu_color_u old_colors[GB_GPU_INDEXES];
+    int pal, c, i;
+
+    gpu->palettes_dirty = 0;
+    memcpy(old_colors, gpu->palette_colors, sizeof(old_colors));
+
+    if (!gb_emu_is_cgb(emu)) {
+        struct gb_dmg_theme *theme = &gpu->display->dmg_theme;
+
+        for (c = 0; c < 4; c++) {
+            uint8_t bg = (gpu->back_palette >> (c * 2)) & 0x03;
+            uint8_t obj0 = (gpu->obj_pal[0] >> (c * 2)) & 0x03;
+            uint8_t obj1 = (gpu->obj_pal[1] >> (c * 2)) & 0x03;
 
-    if ((gpu->ctl & GB_GPU_CTL_BKGD_SET)) {
-        sprite = bkgd_tiles[x_pix / 8];
-        attr = bkgd_attributes[x_pix / 8];
+            gpu->palette_colors[GB_GPU_INDEX(0, c)] = theme->bg[bg];
+            gpu->palette_colors[GB_GPU_INDEX(8, c)] = theme->sprites[0][obj0];
+            gpu->palette_colors[GB_GPU_INDEX(9, c)] = theme->sprites[1][obj1];
+
+            gpu->palette_shade[GB_GPU_INDEX(0, c)] = bg;
+            gpu->palette_shade[GB_GPU_INDEX(8, c)] = obj0;
+            gpu->palette_shade[GB_GPU_INDEX(9, c)] = obj1;
+        }
+
+        gpu->palette_colors[GB_GPU_INDEX_BLANK] = theme->bg[0];
+        gpu->palette_shade[GB_GPU_INDEX_BLANK] = 0;
     } else {
-        sprite = *(int8_t *)&bkgd_tiles[x_pix / 8] + 256;
-        attr = *(int8_t *)&bkgd_attributes[x_pix / 8] + 256;
+        for (pal = 0; pal < 8; pal++) {
+            for (c = 0; c < 4; c++) {
+                const uint8_t *bg = gpu->cgb_bkgd_palette + pal * 8 + c * 2;
+                const uint8_t *obj = gpu->cgb_sprite_palette + pal * 8 + c * 2;
+
+                gpu->palette_colors[GB_GPU_INDEX(pal, c)].i_color = make_cgb_argb_color(bg[0] | (bg[1] << 8), emu->config.cgb_real_colors);
+                gpu->palette_colors[GB_GPU_INDEX(8 + pal, c)].i_color = make_cgb_argb_color(obj[0] | (obj[1] << 8), emu->config.cgb_real_colors);
+            }
+        }
+
+        gpu->palette_colors[GB_GPU_INDEX_BLANK].i_color = make_cgb_argb_color(0xFFFF, emu->config.cgb_real_colors);
+
+        for (i = 0; i < GB_GPU_INDEXES; i++)
+            gpu->palette_shade[i] = make_shade(gpu->palette_colors[i].i_color);
     }
 
-    if (gb_emu_is_cgb(emu)) {
-        x_flip = !!(attr & GB_GPU_CGB_BG_ATTR_X_FLIP);
-        y_flip = !!(attr & GB_GPU_CGB_BG_ATTR_Y_FLIP);
-        vbank = !!(attr & GB_GPU_CGB_BG_ATTR_VBANK);
-        priority = !!(attr & GB_GPU_CGB_BG_ATTR_PRIORITY);
-        cgb_palette = attr & GB_GPU_CGB_BG_ATTR_PAL_NO;
+    for (i = 0; i < GB_GPU_INDEXES; i++)
+        gpu->palette_rgb565[i] = make_rgb565_color(gpu->palette_colors[i].i_color);
+
+    /* The indexes may be the same as before, but they don't look it */
+    if (gpu->format == GB_GPU_FORMAT_INDEX8 && memcmp(old_colors, gpu->palette_colors, sizeof(old_colors)) != 0)
+        gb_gpu_mark_all_dirty(gpu);
+}
+
+/*
+ * The background and window are drawn a row of a tile at a time. Both bytes
+ * of the row are spread out with the tables below, so that every pixel ends
+ * up in its own byte, and the pixels are then picked out left to right. Only
+ * the first and last tiles of a span can be partly on screen.
+ */
+
+/* Each bit of a nibble spread into its own byte, with bit 3 in the lowest
+ * byte - The left-most pixel comes first */
+static const uint32_t tile_nibble_spread[16] = {
+    0x00000000, 0x01000000, 0x00010000, 0x01010000,
+    0x00000100, 0x01000100, 0x00010100, 0x01010100,
+    0x00000001, 0x01000001, 0x00010001, 0x01010001,
+    0x00000101, 0x01000101, 0x00010101, 0x01010101,
+};
+
+/* The same, but with bit 0 in the lowest byte - for X flipped tiles */
+static const uint32_t tile_nibble_spread_flip[16] = {
+    0x00000000, 0x00000001, 0x00000100, 0x00000101,
+    0x00010000, 0x00010001, 0x00010100, 0x00010101,
+    0x01000000, 0x01000001, 0x01000100, 0x01000101,
+    0x01010000, 0x01010001, 0x01010100, 0x01010101,
+};
+
+/* Returns the color number of the 8 pixels in a row of a tile, one per byte,
+ * left-most pixel in the lowest byte */
+static inline uint64_t decode_tile_row(uint8_t lo, uint8_t hi, int x_flip)
+{
+    uint64_t l, h;
+
+    if (!x_flip) {
+        l = tile_nibble_spread[lo >> 4] | ((uint64_t)tile_nibble_spread[lo & 0xF] << 32);
+        h = tile_nibble_spread[hi >> 4] | ((uint64_t)tile_nibble_spread[hi & 0xF] << 32);
+    } else {
+        l = tile_nibble_spread_flip[lo & 0xF] | ((uint64_t)tile_nibble_spread_flip[lo >> 4] << 32);
+        h = tile_nibble_spread_flip[hi & 0xF] | ((uint64_t)tile_nibble_spread_flip[hi >> 4] << 32);
     }
 
-    if (y_flip)
-        tile_offset_byte = 7 - tile_offset_byte;
+    return l | (h << 1);
+}
 
-    tile_index = 7 - (x_pix % 8);
-    if (x_flip)
-        tile_index = 7 - tile_index;
+/* Returns row 'row' of tile 'tile' as returned by decode_tile_row(), decoding
+ * the tile again first if it was written to */
+static inline uint64_t tile_row(struct gb_gpu *gpu, int bank, int tile, int row, int x_flip)
+{
+    uint32_t bit = 1u << (tile % 32);
 
-    lo = gpu->vram[vbank].seg.sprites[sprite][tile_offset_byte * 2] & (1 << tile_index);
-    hi = gpu->vram[vbank].seg.sprites[sprite][tile_offset_byte * 2 + 1] & (1 << tile_index);
+    if (gpu->tile_dirty[bank][tile / 32] & bit) {
+        const uint8_t *data = gpu->vram[bank].seg.sprites[tile];
+        int i;
 
-    c = ((lo)? 1: 0) + ((hi)? 2: 0);
+        for (i = 0; i < 8; i++) {
+            gpu->tile_rows[bank][tile][0][i] = decode_tile_row(data[i * 2], data[i * 2 + 1], 0);
+            gpu->tile_rows[bank][tile][1][i] = decode_tile_row(data[i * 2], data[i * 2 + 1], 1);
+        }
 
-    gpu->bkgd_line_colors[y_pix] = c;
-    gpu->bkgd_priority[y_pix] = priority;
+        gpu->tile_dirty[bank][tile / 32] &= ~bit;
+    }
 
-    /* Pull the actual color out of the background palette
-     * We shift our color on the palette by 'c', moving two bits for every
-     * color, so our target color end's up at the bottom, and then mask out
-     * the rest */
+    return gpu->tile_rows[bank][tile][x_flip][row];
+}
 
-    if (!gb_emu_is_cgb(emu)) {
-        pal_col = (gpu->back_palette >> (c * 2)) & 0x03;
-        line[y_pix] = emu->gpu.display->dmg_theme.bg[pal_col];
-    } else {
-        uint8_t low = gpu->cgb_bkgd_palette[cgb_palette * 8 + c * 2];
-        uint8_t high = gpu->cgb_bkgd_palette[cgb_palette * 8 + c * 2 + 1];
-        uint16_t color = low | (high << 8);
-        line[y_pix].i_color = make_cgb_argb_color(color, emu->config.cgb_real_colors);
+/* Draws screen pixels 'start' to 'end' from a row of the tile map, with
+ * 'start' showing pixel 'map_x' of the row. 'map_x' wraps at the end of the
+ * row. */
+static void render_tile_span(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs, uint8_t *line,
+        uint8_t *bkgd_tiles, uint8_t *bkgd_attributes, int map_x, int start, int end, int tile_offset_byte)
+{
+    uint8_t colors = GB_GPU_INDEX(0, 0);
+    int i = start;
+
+    while (i < end) {
+        int tile_x = (map_x / 8) % 32;
+        int first = map_x % 8;
+        int count = 8 - first;
+        int sprite, row, k, c;
+        uint8_t attr = bkgd_attributes[tile_x];
+        int x_flip = 0, vbank = 0, priority = 0;
+        uint64_t pixels;
+
+        if (count > end - i)
+            count = end - i;
+
+        if ((regs->ctl & GB_GPU_CTL_BKGD_SET))
+            sprite = bkgd_tiles[tile_x];
+        else
+            sprite = *(int8_t *)&bkgd_tiles[tile_x] + 256;
+
+        row = tile_offset_byte;
+
+        if (gb_emu_is_cgb(emu)) {
+            colors = GB_GPU_INDEX(attr & GB_GPU_CGB_BG_ATTR_PAL_NO, 0);
+
+            x_flip = !!(attr & GB_GPU_CGB_BG_ATTR_X_FLIP);
+            vbank = !!(attr & GB_GPU_CGB_BG_ATTR_VBANK);
+            priority = !!(attr & GB_GPU_CGB_BG_ATTR_PRIORITY);
+
+            if (attr & GB_GPU_CGB_BG_ATTR_Y_FLIP)
+                row = 7 - row;
+        }
+
+        pixels = tile_row(gpu, vbank, sprite, row, x_flip) >> (first * 8);
+
+        for (k = 0; k < count; k++, pixels >>= 8) {
+            c = pixels & 0x03;
+
+            line[i + k] = colors + c;
+            gpu->bkgd_line_colors[i + k] = c;
+            gpu->bkgd_priority[i + k] = priority;
+        }
+
+        i += count;
+        map_x += count;
     }
 }
 
-static void render_background(struct gb_emu *emu, struct gb_gpu *gpu)
+static void render_background(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs)
 {
-    union gb_gpu_color_u *line;
+    uint8_t *line;
     int bkgd_y_pix;
     int tile_offset_byte;
-    int i;
     uint8_t *bkgd_tiles;
     uint8_t *bkgd_attributes;
     int tile;
 
-    line = &gpu->screenbuf[gpu->cur_line * GB_SCREEN_WIDTH];
+    line = &gpu->screen_index[regs->cur_line * GB_SCREEN_WIDTH];
 
-    bkgd_y_pix = (gpu->cur_line + gpu->scroll_y) % (8 * 32);
+    bkgd_y_pix = (regs->cur_line + regs->scroll_y) % (8 * 32);
 
     tile = (bkgd_y_pix) / 8 * 32;
-    bkgd_tiles = gpu->vram[0].seg.bkgd[(gpu->ctl & GB_GPU_CTL_BKGD_MAP)? 1: 0] + tile;
-    bkgd_attributes = gpu->vram[1].seg.bkgd[(gpu->ctl & GB_GPU_CTL_BKGD_MAP)? 1: 0] + tile;
+    bkgd_tiles = gpu->vram[0].seg.bkgd[(regs->ctl & GB_GPU_CTL_BKGD_MAP)? 1: 0] + tile;
+    bkgd_attributes = gpu->vram[1].seg.bkgd[(regs->ctl & GB_GPU_CTL_BKGD_MAP)? 1: 0] + tile;
 
     tile_offset_byte = bkgd_y_pix % 8;
 
-    for (i = 0; i < GB_SCREEN_WIDTH; i++) {
-        uint8_t x_pix;
-
-        x_pix = (i + gpu->scroll_x) % (8 * 32);
-
-        render_background_tile(emu, gpu, line, bkgd_tiles, bkgd_attributes, x_pix, i, tile_offset_byte);
-    }
+    render_tile_span(emu, gpu, regs, line, bkgd_tiles, bkgd_attributes, regs->scroll_x, 0, GB_SCREEN_WIDTH, tile_offset_byte);
 }
 
-static void render_window(struct gb_emu *emu, struct gb_gpu *gpu)
+static void render_window(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs)
 {
-    union gb_gpu_color_u *line;
+    uint8_t *line;
     int bkgd_y_pix;
     int tile_offset_byte;
-    int i;
     uint8_t *bkgd_tiles;
     uint8_t *bkgd_attributes;
     int tile;
+    int start, end;
 
-    if (gpu->window_y > gpu->cur_line)
+    if (regs->window_y > regs->cur_line)
         return ;
 
-    line = &gpu->screenbuf[gpu->cur_line * GB_SCREEN_WIDTH];
+    line = &gpu->screen_index[regs->cur_line * GB_SCREEN_WIDTH];
 
-    bkgd_y_pix = gpu->cur_line - gpu->window_y;
+    bkgd_y_pix = regs->cur_line - regs->window_y;
 
     tile = (bkgd_y_pix / 8) * 32;
-    bkgd_tiles      = gpu->vram[0].seg.bkgd[(gpu->ctl & GB_GPU_CTL_WINDOW_MAP)? 1: 0] + tile;
-    bkgd_attributes = gpu->vram[1].seg.bkgd[(gpu->ctl & GB_GPU_CTL_WINDOW_MAP)? 1: 0] + tile;
+    bkgd_tiles      = gpu->vram[0].seg.bkgd[(regs->ctl & GB_GPU_CTL_WINDOW_MAP)? 1: 0] + tile;
+    bkgd_attributes = gpu->vram[1].seg.bkgd[(regs->ctl & GB_GPU_CTL_WINDOW_MAP)? 1: 0] + tile;
 
     tile_offset_byte = bkgd_y_pix % 8;
 
-    for (i = 0; i < GB_SCREEN_WIDTH; i++) {
-        int x_pix;
+    /* Screen pixel 'i' shows pixel 'i - window_x + 7' of the window, which
+     * only covers the width of the screen */
+    start = regs->window_x - 7;
+    if (start < 0)
+        start = 0;
 
-        x_pix = i - gpu->window_x + 7;
+    end = GB_SCREEN_WIDTH + regs->window_x - 7;
+    if (end > GB_SCREEN_WIDTH)
+        end = GB_SCREEN_WIDTH;
 
-        if (x_pix < 0 || x_pix >= GB_SCREEN_WIDTH)
-            continue;
+    if (start >= end)
+        return ;
 
-        render_background_tile(emu, gpu, line, bkgd_tiles, bkgd_attributes, x_pix, i, tile_offset_byte);
-    }
+    render_tile_span(emu, gpu, regs, line, bkgd_tiles, bkgd_attributes, start - regs->window_x + 7, start, end, tile_offset_byte);
 }
 
-static void render_single_sprite(struct gb_emu *emu, struct gb_gpu *gpu, union gb_gpu_color_u *line, int x, int y, uint8_t tile_no, uint8_t flags, int *sprite_priority_map)
+static void render_single_sprite(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs, uint8_t *line, int x, int y, uint8_t tile_no, uint8_t flags, uint8_t *sprite_priority_map)
 {
     int flip_x, flip_y, pal_num, behind_bg;
-    uint8_t tile_hi, tile_lo;
-    uint8_t palette, cgb_palette = 0, vram_bank = 0;
-    int y_off = gpu->cur_line - y;
+    int row;
+    uint64_t pixels;
+    uint8_t colors;
+    uint8_t vram_bank = 0;
+    int y_off = regs->cur_line - y;
     int x_loc = 0;
     int sprite_size = 8;
 
-    if (gpu->ctl & GB_GPU_CTL_SPRITES_SIZE)
+    if (regs->ctl & GB_GPU_CTL_SPRITES_SIZE)
         sprite_size = 16;
 
     flip_x = !!(flags & GB_GPU_SPRITE_FLAG_X_FLIP);
@@ -187,29 +315,27 @@ static void render_single_sprite(struct gb_emu *emu, struct gb_gpu *gpu, union g
     behind_bg = !!(flags & GB_GPU_SPRITE_FLAG_BEHIND_BG);
 
     if (gb_emu_is_cgb(emu)) {
-        cgb_palette = flags & GB_GPU_SPRITE_FLAG_CGB_PAL;
+        colors = GB_GPU_INDEX(8 + (flags & GB_GPU_SPRITE_FLAG_CGB_PAL), 0);
         vram_bank = !!(flags & GB_GPU_SPRITE_FLAG_CGB_VBANK);
-    }
-
-    if (!flip_y) {
-        tile_lo = gpu->vram[vram_bank].seg.sprites[tile_no][y_off * 2];
-        tile_hi = gpu->vram[vram_bank].seg.sprites[tile_no][y_off * 2 + 1];
     } else {
-        tile_lo = gpu->vram[vram_bank].seg.sprites[tile_no][(sprite_size - 1 - y_off) * 2];
-        tile_hi = gpu->vram[vram_bank].seg.sprites[tile_no][(sprite_size - 1 - y_off) * 2 + 1];
+        colors = GB_GPU_INDEX(8 + pal_num, 0);
     }
 
-    palette = gpu->obj_pal[pal_num];
+    if (!flip_y)
+        row = y_off;
+    else
+        row = sprite_size - 1 - y_off;
+
+    /* The second half of a 16 pixel tall sprite is the next tile */
+    pixels = tile_row(gpu, vram_bank, tile_no + row / 8, row % 8, flip_x);
 
-    for (x_loc = 0; x_loc < 8; x_loc++) {
-        int x_pix = ((!flip_x)? 7 - x_loc: x_loc);
-        int sel, col;
+    for (x_loc = 0; x_loc < 8; x_loc++, pixels >>= 8) {
+        int sel;
 
         if (x_loc + x >= GB_SCREEN_WIDTH || x_loc + x < 0)
             continue;
 
-        sel = !!(tile_lo & (1 << x_pix));
-        sel |= (!!(tile_hi & (1 << x_pix))) << 1;
+        sel = pixels & 0x03;
 
         if (sel == 0)
             continue;
@@ -229,34 +355,57 @@ static void render_single_sprite(struct gb_emu *emu, struct gb_gpu *gpu, union g
         else
             sprite_priority_map[x + x_loc] = 1;
 
-        if (!gb_emu_is_cgb(emu)) {
-            col = (palette >> (sel * 2)) & 0x03;
-            line[x + x_loc] = emu->gpu.display->dmg_theme.sprites[pal_num][col];
-        } else {
-            uint8_t low = gpu->cgb_sprite_palette[cgb_palette * 8 + sel * 2];
-            uint8_t high = gpu->cgb_sprite_palette[cgb_palette * 8 + sel * 2 + 1];
-            uint16_t color = low | (high << 8);
-            line[x + x_loc].i_color = make_cgb_argb_color(color, emu->config.cgb_real_colors);
-        }
+        line[x + x_loc] = colors + sel;
     }
 }
 
-static void render_sprites(struct gb_emu *emu, struct gb_gpu *gpu)
+/* Builds the list of sprites on every line. Only the first 10 sprites on a
+ * line are ever drawn, including ones that are off the side of the screen. */
+static void update_line_sprites(struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs)
 {
-    union gb_gpu_color_u *line;
-    int s;
-    int current_line = gpu->cur_line; /* Line being rendered */
-    int count = 0;
     int sprite_size = 8;
-    int sprite_priority_map[GB_SCREEN_WIDTH] = { 0 };
+    int s, l;
+
+    gpu->sprites_dirty = 0;
 
-    if (gpu->ctl & GB_GPU_CTL_SPRITES_SIZE)
+    if (regs->ctl & GB_GPU_CTL_SPRITES_SIZE)
         sprite_size = 16;
 
-    line = &gpu->screenbuf[current_line * GB_SCREEN_WIDTH];
+    memset(gpu->line_sprite_count, 0, sizeof(gpu->line_sprite_count));
 
     for (s = 0; s < 40; s++) {
-        uint8_t *sprite = &gpu->oam.s_attrs[s][0];
+        int y = (int)gpu->oam.s_attrs[s][GB_GPU_SPRITE_ATTR_Y] - 16;
+        int first = (y < 0)? 0: y;
+        int last = y + sprite_size;
+
+        if (last > GB_SCREEN_HEIGHT)
+            last = GB_SCREEN_HEIGHT;
+
+        for (l = first; l < last; l++)
+            if (gpu->line_sprite_count[l] < GB_GPU_LINE_SPRITES)
+                gpu->line_sprites[l][gpu->line_sprite_count[l]++] = s;
+    }
+}
+
+static void render_sprites(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs)
+{
+    uint8_t *line;
+    int i;
+    int current_line = regs->cur_line; /* Line being rendered */
+    uint8_t sprite_priority_map[GB_SCREEN_WIDTH];
+
+    if (gpu->sprites_dirty)
+        update_line_sprites(gpu, regs);
+
+    if (current_line >= GB_SCREEN_HEIGHT || !gpu->line_sprite_count[current_line])
+        return ;
+
+    memset(sprite_priority_map, 0, sizeof(sprite_priority_map));
+
+    line = &gpu->screen_index[current_line * GB_SCREEN_WIDTH];
+
+    for (i = 0; i < gpu->line_sprite_count[current_line]; i++) {
+        uint8_t *sprite = &gpu->oam.s_attrs[gpu->line_sprites[current_line][i]][0];
         int x, y;
         uint8_t attr_tile, attr_flags;
 
@@ -268,41 +417,118 @@ static void render_sprites(struct gb_emu *emu, struct gb_gpu *gpu)
         /* Sprites of size 16 span over two tiles - always an even-odd pair with the last bit.
          * This is true regardless of if the tile number given is the even or
          * odd one, so we mask off the last bit to get the first tile in the pair. */
-        if (sprite_size == 16)
+        if (regs->ctl & GB_GPU_CTL_SPRITES_SIZE)
             attr_tile &= 0xFE;
 
-        if (y >= GB_SCREEN_HEIGHT || y <= -sprite_size)
+        if (x + 8 == 0 || x >= GB_SCREEN_WIDTH)
             continue;
 
-        if (current_line < y || current_line >= y + sprite_size)
-            continue;
+        render_single_sprite(emu, gpu, regs, line, x, y, attr_tile, attr_flags, sprite_priority_map);
+    }
+}
 
-        count++;
+/* Looks up 'line' of 'screen_index' into 'screenbuf' in the screen's format */
+static void output_line(struct gb_gpu *gpu, int line)
+{
+    const uint8_t *index = gpu->screen_index + line * GB_SCREEN_WIDTH;
+    int i;
 
-        if (count == 11)
-            break;
+    switch (gpu->format) {
+    case GB_GPU_FORMAT_ARGB8888: {
+        union gb_gpu_color_u *out = gpu->screenbuf + line * GB_SCREEN_WIDTH;
 
-        if (x + 8 == 0 || x >= GB_SCREEN_WIDTH)
-            continue;
+        for (i = 0; i < GB_SCREEN_WIDTH; i++)
+            out[i] = gpu->palette_colors[index[i]];
+        break;
+    }
+
+    case GB_GPU_FORMAT_RGB565: {
+        uint16_t *out = (uint16_t *)gpu->screenbuf + line * GB_SCREEN_WIDTH;
 
-        render_single_sprite(emu, gpu, line, x, y, attr_tile, attr_flags, sprite_priority_map);
+        for (i = 0; i < GB_SCREEN_WIDTH; i++)
+            out[i] = gpu->palette_rgb565[index[i]];
+        break;
+    }
+
+    case GB_GPU_FORMAT_SHADE2: {
+        uint8_t *out = (uint8_t *)gpu->screenbuf + line * (GB_SCREEN_WIDTH / 4);
+
+        for (i = 0; i < GB_SCREEN_WIDTH; i += 4, index += 4)
+            out[i / 4] = gpu->palette_shade[index[0]]
+                         | (gpu->palette_shade[index[1]] << 2)
+                         | (gpu->palette_shade[index[2]] << 4)
+                         | (gpu->palette_shade[index[3]] << 6);
+        break;
+    }
+
+    case GB_GPU_FORMAT_INDEX8:
+        /* Displayed as-is */
+        break;
+    }
+}
+
+/* Marks 'line' dirty if it was drawn differently from last time */
+static void update_line_hash(struct gb_gpu *gpu, int line)
+{
+    int words = gb_gpu_format_line_bytes(gpu->format) / 8;
+    const uint64_t *pixels = (const uint64_t *)gb_gpu_screen(gpu) + line * words;
+    uint64_t hash = 14695981039346656037ULL;
+    int i;
+
+    /* FNV-1a, eight bytes at a time */
+    for (i = 0; i < words; i++) {
+        hash ^= pixels[i];
+        hash *= 1099511628211ULL;
+    }
+
+    if (hash != gpu->line_hash[line]) {
+        gpu->line_hash[line] = hash;
+        gpu->dirty_lines[line / 32] |= 1u << (line % 32);
     }
 }
 
+/* Draws line 'regs->cur_line' of the screen. Everything it uses apart from
+ * 'regs' has to stay the same until it is done, see gb_gpu_render_sync(). */
+void gb_gpu_render_line_regs(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs)
+{
+    if (gpu->palettes_dirty)
+        update_palettes(emu, gpu);
+
+    if (regs->ctl & GB_GPU_CTL_BKGD)
+        render_background(emu, gpu, regs);
+
+    if (regs->ctl & GB_GPU_CTL_WINDOW)
+        render_window(emu, gpu, regs);
+
+    if (regs->ctl & GB_GPU_CTL_SPRITES)
+        render_sprites(emu, gpu, regs);
+
+    output_line(gpu, regs->cur_line);
+    update_line_hash(gpu, regs->cur_line);
+}
+
 void gb_gpu_render_line(struct gb_emu *emu, struct gb_gpu *gpu)
 {
+    struct gb_gpu_line_regs regs;
 
-    if (!(gpu->ctl & GB_GPU_CTL_DISPLAY))
+    if (!(gpu->ctl & GB_GPU_CTL_DISPLAY) || gpu->skip_frame)
         return ;
 
-    if (gpu->ctl & GB_GPU_CTL_BKGD)
-        render_background(emu, gpu);
+    regs.cur_line = gpu->cur_line;
+    regs.ctl = gpu->ctl;
+    regs.scroll_x = gpu->scroll_x;
+    regs.scroll_y = gpu->scroll_y;
+    regs.window_x = gpu->window_x;
+    regs.window_y = gpu->window_y;
 
-    if (gpu->ctl & GB_GPU_CTL_WINDOW)
-        render_window(emu, gpu);
+#ifdef CONFIG_RENDER_THREAD
+    if (gpu->render_thread) {
+        gb_render_thread_queue(gpu->render_thread, &regs);
+        return ;
+    }
+#endif
 
-    if (gpu->ctl & GB_GPU_CTL_SPRITES)
-        render_sprites(emu, gpu);
+    gb_gpu_render_line_regs(emu, gpu, &regs);
 }
 
 void gb_gpu_update_key_line(struct gb_emu *emu)
@@ -338,10 +564,15 @@ void gb_gpu_update_key_line(struct gb_emu *emu)
 
 void gb_gpu_display_screen(struct gb_emu *emu, struct gb_gpu *gpu)
 {
+    gb_gpu_render_sync(gpu);
+
     (gpu->display->get_keystate) (emu, &gpu->keypad);
     gb_gpu_update_key_line(emu);
 
-    (gpu->display->disp_buf) (gpu->display, gpu->screenbuf);
+    if (!gpu->skip_frame) {
+        (gpu->display->disp_buf) (gpu->display, gb_gpu_screen(gpu), gpu->dirty_lines);
+        memset(gpu->dirty_lines, 0, sizeof(gpu->dirty_lines));
+    }
 
     /* This is a convient time to write the save-file if the eram is modified,
      * since it ensure we only do it occasionally and not on every eram write. */
@@ -351,26 +582,92 @@ void gb_gpu_display_screen(struct gb_emu *emu, struct gb_gpu *gpu)
     }
 }
 
+/* The length of a frame in real time, at 4194304 ticks a second */
+#define GB_GPU_FRAME_NS ((uint64_t)GB_GPU_CLOCK_FRAME * 1000000000 / 4194304)
+
+/* The most frames GB_FRAMESKIP_AUTO will skip in a row, so that something is
+ * still displayed when the emulator can't keep up at all */
+#define GB_GPU_FRAMESKIP_AUTO_MAX 8
+
+static uint64_t gpu_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns whether the next frame should be skipped */
+static int frame_skip_next(struct gb_emu *emu, struct gb_gpu *gpu)
+{
+    int frameskip = emu->config.frameskip;
+    int skip;
+
+    if (frameskip == GB_FRAMESKIP_AUTO) {
+        uint64_t now = gpu_time_ns();
+        uint64_t slack = GB_GPU_FRAME_NS * GB_GPU_FRAMESKIP_AUTO_MAX;
+
+        gpu->frame_due_ns += GB_GPU_FRAME_NS;
+
+        /* Start counting again from now if we're too far ahead or behind to
+         * catch up - after starting, or being paused in the debugger */
+        if (gpu->frame_due_ns > now + GB_GPU_FRAME_NS || gpu->frame_due_ns + slack < now)
+            gpu->frame_due_ns = now + GB_GPU_FRAME_NS;
+
+        skip = now > gpu->frame_due_ns - GB_GPU_FRAME_NS
+               && gpu->frames_skipped < GB_GPU_FRAMESKIP_AUTO_MAX;
+    } else {
+        skip = gpu->frames_skipped < frameskip;
+    }
+
+    if (skip)
+        gpu->frames_skipped++;
+    else
+        gpu->frames_skipped = 0;
+
+    return skip;
+}
+
+static void gb_gpu_end_frame(struct gb_emu *emu, struct gb_gpu *gpu)
+{
+    gpu->frame_count++;
+    gb_gpu_display_screen(emu, gpu);
+    gpu->frame_is_done = 1;
+
+    gpu->skip_frame = frame_skip_next(emu, gpu);
+}
+
 void gb_gpu_ctl_change(struct gb_emu *emu, struct gb_gpu *gpu, uint8_t new_ctl)
 {
     uint8_t diff = gpu->ctl ^ new_ctl;
 
+    if (diff & (GB_GPU_CTL_DISPLAY | GB_GPU_CTL_SPRITES_SIZE))
+        gb_gpu_render_sync(gpu);
+
     if (diff & GB_GPU_CTL_DISPLAY) {
-        int i, j;
-        for (i = 0; i < GB_SCREEN_HEIGHT; i++) {
-            for (j = 0; j < GB_SCREEN_WIDTH; j++) {
-                if (gb_emu_is_cgb(emu))
-                    gpu->screenbuf[i * GB_SCREEN_WIDTH + j].i_color = make_cgb_argb_color(0xFFFF, emu->config.cgb_real_colors);
-                else
-                    gpu->screenbuf[i * GB_SCREEN_WIDTH + j] = gpu->display->dmg_theme.bg[0];
-            }
-        }
+        int i;
+
+        if (gpu->palettes_dirty)
+            update_palettes(emu, gpu);
+
+        memset(gpu->screen_index, GB_GPU_INDEX_BLANK, sizeof(gpu->screen_index));
+        for (i = 0; i < GB_SCREEN_HEIGHT; i++)
+            output_line(gpu, i);
+
+        /* Whatever is drawn next will be different from the blank screen */
+        memset(gpu->line_hash, 0, sizeof(gpu->line_hash));
+        gb_gpu_mark_all_dirty(gpu);
+
         gb_gpu_display_screen(emu, gpu);
 
         gpu->cur_line = 0;
         gpu->mode = GB_GPU_MODE_VBLANK;
     }
 
+    if (diff & GB_GPU_CTL_SPRITES_SIZE)
+        gpu->sprites_dirty = 1;
+
     gpu->ctl = new_ctl;
 }
 
@@ -390,15 +687,16 @@ void gb_emu_gpu_tick(struct gb_emu *emu, int cycles)
 
     if (!(gpu->ctl & GB_GPU_CTL_DISPLAY)) {
         gpu->mode = GB_GPU_MODE_HBLANK;
-        gpu->clock += 4;
+
+        /* Counted in ticks, which are only four cycles in normal speed. Only
+         * normal speed advances more then one tick at a time */
+        gpu->clock += emu->cpu.double_speed? 4: cycles;
 
         /* We keep counting the cycles even when the display is off to keep the
          * timing right - display the screen also delays the emulation speed */
-        if (gpu->clock >= GB_GPU_CLOCK_VBLANK * GB_GPU_VBLANK_LENGTH
-                          + (GB_GPU_CLOCK_HBLANK + GB_GPU_CLOCK_OAM + GB_GPU_CLOCK_VRAM) * GB_SCREEN_HEIGHT) {
-            gb_gpu_display_screen(emu, gpu);
+        if (gpu->clock >= GB_GPU_CLOCK_FRAME) {
+            gb_gpu_end_frame(emu, gpu);
             gpu->clock = 0;
-	        gpu->frame_is_done = 1;
         }
         return ;
     }
@@ -413,8 +711,7 @@ void gb_emu_gpu_tick(struct gb_emu *emu, int cycles)
 
             if (gpu->cur_line == GB_SCREEN_HEIGHT) {
                 gpu->mode = GB_GPU_MODE_VBLANK;
-                gb_gpu_display_screen(emu, gpu);
-	            gpu->frame_is_done = 1;
+                gb_gpu_end_frame(emu, gpu);
 
                 emu->cpu.int_flags |= (1 << GB_INT_VBLANK);
 
@@ -468,19 +765,73 @@ void gb_emu_gpu_tick(struct gb_emu *emu, int cycles)
     }
 }
 
+/* Returns the number of cycles until the GPU reaches its next mode change.
+ * Every interrupt the GPU can raise happens on a mode change, so nothing
+ * visible to the CPU happens before then. When the display is off the only
+ * event is the end of the frame. */
+int gb_gpu_event_cycles(struct gb_gpu *gpu)
+{
+    int limit = 0;
+
+    if (!(gpu->ctl & GB_GPU_CTL_DISPLAY)) {
+        if (gpu->clock >= GB_GPU_CLOCK_FRAME)
+            return 4;
+
+        return GB_GPU_CLOCK_FRAME - gpu->clock;
+    }
+
+    switch (gpu->mode) {
+    case GB_GPU_MODE_HBLANK:
+        limit = GB_GPU_CLOCK_HBLANK;
+        break;
+
+    case GB_GPU_MODE_OAM:
+        limit = GB_GPU_CLOCK_OAM;
+        break;
+
+    case GB_GPU_MODE_VRAM:
+        limit = GB_GPU_CLOCK_VRAM;
+        break;
+
+    case GB_GPU_MODE_VBLANK:
+        limit = GB_GPU_CLOCK_VBLANK;
+        break;
+    }
+
+    if (gpu->clock >= limit)
+        return 4;
+
+    return limit - gpu->clock;
+}
+
 void gb_gpu_dma(struct gb_emu *emu, uint8_t dma_addr)
 {
     uint16_t src_start = ((int)dma_addr) << 8;
+    const uint8_t *src;
     int i;
 
-    for (i = 0; i < 0xA0; i++)
-        emu->gpu.oam.mem[i] = gb_emu_read8(emu, src_start + i);
+    gb_gpu_render_sync(&emu->gpu);
+
+    /* The source never crosses a page, so it can usually be copied at once */
+    src = gb_mmu_read_ptr(emu, src_start);
+    if (src) {
+        memcpy(emu->gpu.oam.mem, src, 0xA0);
+    } else {
+        for (i = 0; i < 0xA0; i++)
+            emu->gpu.oam.mem[i] = gb_emu_read8(emu, src_start + i);
+    }
+
+    emu->gpu.sprites_dirty = 1;
 }
 
 void gb_gpu_init(struct gb_gpu *gpu)
 {
     memset(gpu, 0, sizeof(*gpu));
     memset(gpu->screenbuf, 0x00, sizeof(gpu->screenbuf));
+    memset(gpu->tile_dirty, 0xFF, sizeof(gpu->tile_dirty));
+    gb_gpu_mark_all_dirty(gpu);
+    gb_gpu_palettes_flush(gpu);
+    gpu->sprites_dirty = 1;
 
     gpu->keypad.key_a = 1;
     gpu->keypad.key_b = 1;
@@ -492,6 +843,22 @@ void gb_gpu_init(struct gb_gpu *gpu)
     gpu->keypad.key_select = 1;
 }
 
+/* The screen is cleared, since what was drawn before is in the old format */
+void gb_gpu_set_format(struct gb_gpu *gpu, enum gb_gpu_format format)
+{
+    gb_gpu_render_sync(gpu);
+
+    if (gpu->format == format)
+        return ;
+
+    gpu->format = format;
+
+    memset(gpu->screenbuf, 0, sizeof(gpu->screenbuf));
+    memset(gpu->screen_index, 0, sizeof(gpu->screen_index));
+    memset(gpu->line_hash, 0, sizeof(gpu->line_hash));
+    gb_gpu_mark_all_dirty(gpu);
+}
+
 uint8_t gb_gpu_vram_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 {
     //if (emu->gpu.mode != GB_GPU_MODE_VRAM)
@@ -502,10 +869,14 @@ uint8_t gb_gpu_vram_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 
 void gb_gpu_vram_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t byte)
 {
+    gb_gpu_render_sync(&emu->gpu);
+
     //if (emu->gpu.mode != GB_GPU_MODE_VRAM)
         emu->gpu.vram[emu->gpu.cgb_vram_bank_no].mem[addr] = byte;
     //else
     //    printf("Invalid VBANK write\n");
+
+    gb_gpu_vram_touch(&emu->gpu, emu->gpu.cgb_vram_bank_no, addr);
 }
 
 uint8_t gb_gpu_sprite_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
@@ -518,7 +889,10 @@ uint8_t gb_gpu_sprite_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 
 void gb_gpu_sprite_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t byte)
 {
-    if (emu->gpu.mode != GB_GPU_MODE_VRAM && emu->gpu.mode != GB_GPU_MODE_OAM)
+    if (emu->gpu.mode != GB_GPU_MODE_VRAM && emu->gpu.mode != GB_GPU_MODE_OAM) {
+        gb_gpu_render_sync(&emu->gpu);
         emu->gpu.oam.mem[addr] = byte;
+        emu->gpu.sprites_dirty = 1;
+    }
 }
 
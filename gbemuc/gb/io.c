@@ -1,6 +1,7 @@
 
 #include "common.h"
 
+#include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -12,357 +13,470 @@
 #include "gb_internal.h"
 #include "debug.h"
 
-void gb_emu_io_reset(struct gb_emu *emu)
+/*
+ * I/O registers are looked up in a table of 128 handlers, one for each
+ * register, which gb_emu_io_reset() fills in for the type of Gameboy being
+ * emulated. Registers that only exist on the CGB are left empty on the DMG.
+ *
+ * Most registers just hold a value, and are read and written straight through
+ * their place in the gb_emu without a handler.
+ */
+
+#define IO_FIELD(field) offsetof(struct gb_emu, field)
+
+static uint8_t io_sound_read(struct gb_emu *emu, uint8_t reg)
 {
-    emu->gpu.ctl = 0x91;
+    if (emu->sound.disabled)
+        return 0;
 
-    emu->gpu.cur_line = 0;
-    emu->gpu.cur_line_cmp = 0;
-    emu->gpu.scroll_x = 0;
-    emu->gpu.scroll_y = 0;
-    emu->gpu.status = 0;
+    return gb_sound_read(&emu->sound, emu->sound.apu_cycles, 0xFF00 + reg);
+}
 
-    emu->gpu.window_x = 0;
-    emu->gpu.window_y = 0;
+static void io_sound_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    if (!emu->sound.disabled)
+        gb_sound_write(&emu->sound, emu->sound.apu_cycles, 0xFF00 + reg, byte);
+}
 
-    emu->gpu.back_palette = 0xE4;
+static void io_bios_flag_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    if (byte == 1) {
 
-    emu->gpu.cgb_vram_bank_no = 0;
-    emu->mmu.cgb_wram_bank_no = 1;
+        /* Games know they're running on a CGB if register A is set to 0x11
+         * on startup. So we do that here, which happens right before the
+         * BIOS starts the game */
+        if (!emu->mmu.bios_flag && gb_emu_is_cgb(emu))
+            emu->cpu.r.b[GB_REG_A] = 0x11;
 
-    emu->timer.div = 0;
-    emu->timer.tima = 0;
-    emu->timer.tma = 0;
-    emu->timer.tac = 0;
+        emu->mmu.bios_flag = 1;
+        gb_mmu_fetch_flush(&emu->mmu);
+    }
+    DEBUG_ON();
 }
 
-uint8_t gb_emu_io_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
+static void io_ctl_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
 {
-    int ret = 0x100;
+    gb_gpu_ctl_change(emu, &emu->gpu, byte);
+}
 
-    switch (addr + low) {
-    case GB_IO_CPU_IF:
-        ret = emu->cpu.int_flags;
-        break;
+static void io_palette_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    gb_gpu_render_sync(&emu->gpu);
 
-    case GB_IO_GPU_CTL:
-        ret = emu->gpu.ctl;
+    switch (0xFF00 + reg) {
+    case GB_IO_GPU_PALETTE:
+        emu->gpu.back_palette = byte;
         break;
 
-    case GB_IO_GPU_STATUS:
-        ret = emu->gpu.status & 0xF8;
-        ret |= emu->gpu.mode;
-        ret |= (emu->gpu.cur_line == emu->gpu.cur_line_cmp)? 4: 0;
+    case GB_IO_OBJ_PAL1:
+        emu->gpu.obj_pal[0] = byte;
         break;
 
-    case GB_IO_GPU_SCRY:
-        ret = emu->gpu.scroll_y;
+    case GB_IO_OBJ_PAL2:
+        emu->gpu.obj_pal[1] = byte;
         break;
+    }
 
-    case GB_IO_GPU_SCRX:
-        ret = emu->gpu.scroll_x;
-        break;
+    gb_gpu_palettes_flush(&emu->gpu);
+}
 
-    case GB_IO_GPU_LY:
-        ret = emu->gpu.cur_line;
-        break;
+static uint8_t io_status_read(struct gb_emu *emu, uint8_t reg)
+{
+    uint8_t ret;
 
-    case GB_IO_GPU_LYC:
-        ret = emu->gpu.cur_line_cmp;
-        break;
+    ret = emu->gpu.status & 0xF8;
+    ret |= emu->gpu.mode;
+    ret |= (emu->gpu.cur_line == emu->gpu.cur_line_cmp)? 4: 0;
 
-    case GB_IO_GPU_PALETTE:
-        ret = emu->gpu.back_palette;
-        break;
+    return ret;
+}
 
-    case GB_IO_GPU_WX:
-        ret = emu->gpu.window_x;
-        break;
+static void io_status_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.status = byte & 0x78;
+}
 
-    case GB_IO_GPU_WY:
-        ret = emu->gpu.window_y;
-        break;
+static void io_ly_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.cur_line = 0;
 
-    case GB_IO_OBJ_PAL1:
-        ret = emu->gpu.obj_pal[0];
-        break;
+    if ((emu->gpu.status & GB_GPU_STATUS_CONC_INT)
+        && emu->gpu.cur_line == emu->gpu.cur_line_cmp)
+        emu->cpu.int_flags |= (1 << GB_INT_LCD_STAT);
+}
 
-    case GB_IO_OBJ_PAL2:
-        ret = emu->gpu.obj_pal[1];
-        break;
+static void io_dma_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    gb_gpu_dma(emu, byte);
+}
 
-    case GB_IO_KEYPAD:
-        ret = emu->gpu.key_line;
-        break;
+static void io_keypad_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.key_select = byte & 0x30;
+    gb_gpu_update_key_line(emu);
+}
 
-    case GB_IO_TIMER_DIV:
-        ret = emu->timer.div;
-        break;
+static void io_div_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->timer.div = 0;
+    emu->timer.div_count = 0;
+}
 
-    case GB_IO_TIMER_TIMA:
-        ret = emu->timer.tima;
-        break;
+static void io_tima_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->timer.tima = byte;
+    emu->timer.tima_count = 0;
+}
 
-    case GB_IO_TIMER_TMA:
-        ret = emu->timer.tma;
-        break;
+static void io_tac_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    gb_timer_update_tac(emu, byte);
+}
 
-    case GB_IO_TIMER_TAC:
-        ret = emu->timer.tac;
-        break;
+/*
+ *
+ * CGB only
+ *
+ */
 
-    case 0xFF10 ... 0xFF3F:
-        ret = gb_sound_read(&emu->sound, emu->sound.apu_cycles, addr + low);
-        break;
-    }
+static uint8_t io_wram_bank_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->mmu.cgb_wram_bank_no;
+}
 
-    if (!gb_emu_is_cgb(emu) || ret != 0x100) {
-        if (ret == 0x100)
-            ret = 0xFF;
+static void io_wram_bank_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->mmu.cgb_wram_bank_no = byte & 0x07;
+    gb_mmu_fetch_flush(&emu->mmu);
+}
 
-        return ret;
-    }
+static uint8_t io_vram_bank_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->gpu.cgb_vram_bank_no;
+}
 
-    switch (addr + low) {
-    case GB_IO_CGB_WRAM_BANK_NO:
-        ret = emu->mmu.cgb_wram_bank_no;
-        break;
+static void io_vram_bank_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.cgb_vram_bank_no = byte & 0x1;
+}
 
-    case GB_IO_CGB_VRAM_BANK_NO:
-        ret = emu->gpu.cgb_vram_bank_no;
-        break;
+static uint8_t io_bg_pal_index_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->gpu.cgb_bkgd_palette_index;
+}
 
-    case GB_IO_CGB_BG_PAL_INDEX:
-        ret = emu->gpu.cgb_bkgd_palette_index;
-        break;
+static void io_bg_pal_index_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.cgb_bkgd_palette_index = byte;
+}
 
-    case GB_IO_CGB_BG_PAL_DATA:
-        ret = emu->gpu.cgb_bkgd_palette[emu->gpu.cgb_bkgd_palette_index & 0x3F];
-        break;
+static uint8_t io_bg_pal_data_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->gpu.cgb_bkgd_palette[emu->gpu.cgb_bkgd_palette_index & 0x3F];
+}
 
-    case GB_IO_CGB_SPRITE_PAL_INDEX:
-        ret = emu->gpu.cgb_sprite_palette_index;
-        break;
+static void io_bg_pal_data_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    gb_gpu_render_sync(&emu->gpu);
 
-    case GB_IO_CGB_SPRITE_PAL_DATA:
-        ret = emu->gpu.cgb_sprite_palette[emu->gpu.cgb_sprite_palette_index & 0x3F];
-        break;
+    emu->gpu.cgb_bkgd_palette[emu->gpu.cgb_bkgd_palette_index & 0x3F] = byte;
+    gb_gpu_palettes_flush(&emu->gpu);
+
+    if (emu->gpu.cgb_bkgd_palette_index & GB_GPU_CGB_PAL_INDEX_AUTO_INCREMENT)
+        emu->gpu.cgb_bkgd_palette_index = (emu->gpu.cgb_bkgd_palette_index + 1) & 0xBF;
+}
 
+static uint8_t io_sprite_pal_index_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->gpu.cgb_sprite_palette_index;
+}
+
+static void io_sprite_pal_index_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->gpu.cgb_sprite_palette_index = byte;
+}
+
+static uint8_t io_sprite_pal_data_read(struct gb_emu *emu, uint8_t reg)
+{
+    return emu->gpu.cgb_sprite_palette[emu->gpu.cgb_sprite_palette_index & 0x3F];
+}
+
+static void io_sprite_pal_data_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    gb_gpu_render_sync(&emu->gpu);
+
+    emu->gpu.cgb_sprite_palette[emu->gpu.cgb_sprite_palette_index & 0x3F] = byte;
+    gb_gpu_palettes_flush(&emu->gpu);
+
+    if (emu->gpu.cgb_sprite_palette_index & GB_GPU_CGB_PAL_INDEX_AUTO_INCREMENT)
+        emu->gpu.cgb_sprite_palette_index = (emu->gpu.cgb_sprite_palette_index + 1) & 0xBF;
+}
+
+static uint8_t io_hdma_read(struct gb_emu *emu, uint8_t reg)
+{
+    switch (0xFF00 + reg) {
     case GB_IO_CGB_HDMA_SOURCE_LOW:
-        ret = emu->mmu.hdma_source & 0xFF;
-        break;
+        return emu->mmu.hdma_source & 0xFF;
 
     case GB_IO_CGB_HDMA_SOURCE_HIGH:
-        ret = (emu->mmu.hdma_source >> 8) & 0xFF;
-        break;
+        return (emu->mmu.hdma_source >> 8) & 0xFF;
 
     case GB_IO_CGB_HDMA_DEST_LOW:
-        ret = emu->mmu.hdma_dest & 0xFF;
-        break;
+        return emu->mmu.hdma_dest & 0xFF;
 
     case GB_IO_CGB_HDMA_DEST_HIGH:
-        ret = (emu->mmu.hdma_dest >> 8) & 0xFF;
-        break;
+        return (emu->mmu.hdma_dest >> 8) & 0xFF;
 
     case GB_IO_CGB_HDMA_MODE:
-        ret = ((!emu->mmu.hdma_active) << 7) | (emu->mmu.hdma_length_left / 0x10 - 1);
-        break;
-
-    case GB_IO_CPU_CGB_KEY1:
-        ret = (emu->cpu.double_speed << 7) | emu->cpu.do_speed_switch;
-        break;
+    default:
+        return ((!emu->mmu.hdma_active) << 7) | (emu->mmu.hdma_length_left / 0x10 - 1);
     }
-
-    if (ret == 0x100)
-        ret = 0xFF;
-
-    return ret;
 }
 
-void gb_emu_io_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t byte)
+static void io_hdma_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
 {
-    switch (addr + low) {
-    case GB_IO_BIOS_FLAG:
-        if (byte == 1) {
-
-            /* Games know they're running on a CGB if register A is set to 0x11
-             * on startup. So we do that here, which happens right before the
-             * BIOS starts the game */
-            if (!emu->mmu.bios_flag && gb_emu_is_cgb(emu))
-                emu->cpu.r.b[GB_REG_A] = 0x11;
-
-            emu->mmu.bios_flag = 1;
-        }
-        DEBUG_ON();
+    switch (0xFF00 + reg) {
+    case GB_IO_CGB_HDMA_SOURCE_LOW:
+        emu->mmu.hdma_source = (emu->mmu.hdma_source & 0xFF00) | (byte & 0xF0);
         break;
 
-    case GB_IO_CPU_IF:
-        emu->cpu.int_flags = byte;
+    case GB_IO_CGB_HDMA_SOURCE_HIGH:
+        emu->mmu.hdma_source = (emu->mmu.hdma_source & 0x00FF) | (byte << 8);
         break;
 
-    case GB_IO_GPU_CTL:
-        gb_gpu_ctl_change(emu, &emu->gpu, byte);
+    case GB_IO_CGB_HDMA_DEST_LOW:
+        emu->mmu.hdma_dest = (emu->mmu.hdma_dest & 0xFF00) | (byte & 0xF0);
         break;
 
-    case GB_IO_GPU_STATUS:
-        emu->gpu.status = byte & 0x78;
+    case GB_IO_CGB_HDMA_DEST_HIGH:
+        emu->mmu.hdma_dest = (emu->mmu.hdma_dest & 0x00FF) | ((byte & 0x1F) << 8) | 0x8000;
         break;
+    }
+}
 
-    case GB_IO_GPU_SCRY:
-        emu->gpu.scroll_y = byte;
-        break;
+/* Returns the HDMA's source if it can be copied straight into VRAM. A source in
+ * VRAM could overlap the destination, so it's left to the MMU along with a
+ * destination past the end of VRAM. */
+static const uint8_t *hdma_source_ptr(struct gb_emu *emu)
+{
+    if ((emu->mmu.hdma_source & 0xE000) == 0x8000 || (emu->mmu.hdma_dest & 0xE000) != 0x8000)
+        return NULL;
 
-    case GB_IO_GPU_SCRX:
-        emu->gpu.scroll_x = byte;
-        break;
+    return gb_mmu_read_ptr(emu, emu->mmu.hdma_source);
+}
 
-    case GB_IO_GPU_LY:
-        emu->gpu.cur_line = 0;
+/* Copies the next 'len' bytes of the HDMA into VRAM, without taking any time.
+ * Spans that can be read directly are copied at once, rather then a byte at a
+ * time through the MMU. */
+void gb_emu_hdma_copy(struct gb_emu *emu, int len)
+{
+    struct gb_mmu *mmu = &emu->mmu;
+    int bank = emu->gpu.cgb_vram_bank_no;
+
+    gb_gpu_render_sync(&emu->gpu);
+
+    while (len) {
+        uint16_t src = mmu->hdma_source, dest = mmu->hdma_dest;
+        const uint8_t *ptr = hdma_source_ptr(emu);
+        int count = len;
+
+        if (!ptr) {
+            /* The source could be the HDMA registers themselves, so they're
+             * kept up to date after every byte */
+            gb_emu_write8(emu, dest, gb_emu_read8(emu, src));
+
+            mmu->hdma_source++;
+            mmu->hdma_dest++;
+            mmu->hdma_length_left--;
+            len--;
+            continue;
+        }
 
-        if ((emu->gpu.status & GB_GPU_STATUS_CONC_INT)
-            && emu->gpu.cur_line == emu->gpu.cur_line_cmp)
-            emu->cpu.int_flags |= (1 << GB_INT_LCD_STAT);
-        break;
+        /* Stop at the end of either page */
+        if (count > 0x100 - (src & 0xFF))
+            count = 0x100 - (src & 0xFF);
 
-    case GB_IO_GPU_LYC:
-        emu->gpu.cur_line_cmp = byte;
+        if (count > 0x100 - (dest & 0xFF))
+            count = 0x100 - (dest & 0xFF);
 
-        break;
+        memcpy(emu->gpu.vram[bank].mem + (dest - 0x8000), ptr, count);
+        gb_gpu_vram_touch_range(&emu->gpu, bank, dest - 0x8000, count);
 
-    case GB_IO_GPU_PALETTE:
-        emu->gpu.back_palette = byte;
-        break;
+        if (mmu->dirty_pages)
+            mmu->dirty_pages[dest >> 8] = 1;
 
-    case GB_IO_GPU_WX:
-        emu->gpu.window_x = byte;
-        break;
+        mmu->hdma_source += count;
+        mmu->hdma_dest += count;
+        mmu->hdma_length_left -= count;
+        len -= count;
+    }
+}
 
-    case GB_IO_GPU_WY:
-        emu->gpu.window_y = byte;
-        break;
+static void io_hdma_mode_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    if (emu->mmu.hdma_active) {
+        if ((byte & GB_CGB_HDMA_DMA_TYPE) == 0)
+            emu->mmu.hdma_active = 0;
+        return ;
+    }
 
-    case GB_IO_GPU_DMA:
-        gb_gpu_dma(emu, byte);
-        break;
+    emu->mmu.hdma_type = byte & GB_CGB_HDMA_DMA_TYPE;
+    emu->mmu.hdma_length_left = ((byte & 0x7F) + 1) * 0x10;
+    emu->mmu.hdma_active = 1;
 
-    case GB_IO_OBJ_PAL1:
-        emu->gpu.obj_pal[0] = byte;
-        break;
+    if (emu->mmu.hdma_type == GB_CGB_HDMA_DMA_GENERAL) {
+        int tick = emu->cpu.double_speed? 2: 4;
 
-    case GB_IO_OBJ_PAL2:
-        emu->gpu.obj_pal[1] = byte;
-        break;
+        /* Every two bytes take a tick, which happens before they're copied.
+         * When the source can be read directly, the ticks after the first one
+         * that can't reach a GPU or timer event are run together, and the
+         * bytes they cover copied in one go. Anything else is still read a
+         * tick at a time, since it may be a register that changes. */
+        while (emu->mmu.hdma_length_left) {
+            int extra = 0;
 
-    case GB_IO_KEYPAD:
-        emu->gpu.key_select = byte & 0x30;
-        gb_gpu_update_key_line(emu);
-        break;
+            gb_emu_clock_tick(emu);
 
-    case GB_IO_TIMER_DIV:
-        emu->timer.div = 0;
-        emu->timer.div_count = 0;
-        break;
+            if (hdma_source_ptr(emu)) {
+                int page_left = 0x100 - (emu->mmu.hdma_source & 0xFF);
 
-    case GB_IO_TIMER_TIMA:
-        emu->timer.tima = byte;
-        emu->timer.tima_count = 0;
-        break;
+                extra = (gb_emu_clock_event_cycles(emu) - 1) / tick;
+                if (extra > emu->mmu.hdma_length_left / 2 - 1)
+                    extra = emu->mmu.hdma_length_left / 2 - 1;
 
-    case GB_IO_TIMER_TMA:
-        emu->timer.tma = byte;
-        break;
+                if (extra > page_left / 2 - 1)
+                    extra = page_left / 2 - 1;
+            }
 
-    case GB_IO_TIMER_TAC:
-        gb_timer_update_tac(emu, byte);
-        break;
+            if (extra)
+                gb_emu_clock_advance(emu, extra * tick);
 
-    case 0xFF10 ... 0xFF3F:
-        gb_sound_write(&emu->sound, emu->sound.apu_cycles, addr + low, byte);
-        break;
+            gb_emu_hdma_copy(emu, (extra + 1) * 2);
+        }
+
+        emu->mmu.hdma_active = 0;
+        emu->mmu.hdma_length_left = 0xFF;
     }
+}
 
-    if (!gb_emu_is_cgb(emu))
-        return ;
+static uint8_t io_key1_read(struct gb_emu *emu, uint8_t reg)
+{
+    return (emu->cpu.double_speed << 7) | emu->cpu.do_speed_switch;
+}
 
-    switch (addr + low) {
-    case GB_IO_CGB_WRAM_BANK_NO:
-        emu->mmu.cgb_wram_bank_no = byte & 0x07;
-        break;
+static void io_key1_write(struct gb_emu *emu, uint8_t reg, uint8_t byte)
+{
+    emu->cpu.do_speed_switch = byte & 1;
+}
 
-    case GB_IO_CGB_VRAM_BANK_NO:
-        emu->gpu.cgb_vram_bank_no = byte & 0x1;
-        break;
+static void io_set(struct gb_emu *emu, uint16_t addr, uint8_t (*read8) (struct gb_emu *, uint8_t), void (*write8) (struct gb_emu *, uint8_t, uint8_t), size_t offset)
+{
+    struct gb_io_reg *reg = emu->io.regs + (addr - 0xFF00);
 
-    case GB_IO_CGB_BG_PAL_INDEX:
-        emu->gpu.cgb_bkgd_palette_index = byte;
-        break;
+    reg->read8 = read8;
+    reg->write8 = write8;
+    reg->offset = offset;
+}
 
-    case GB_IO_CGB_BG_PAL_DATA:
-        emu->gpu.cgb_bkgd_palette[emu->gpu.cgb_bkgd_palette_index & 0x3F] = byte;
+static void io_setup_regs(struct gb_emu *emu)
+{
+    uint16_t addr;
+
+    memset(&emu->io, 0, sizeof(emu->io));
+
+    io_set(emu, GB_IO_KEYPAD, NULL, io_keypad_write, IO_FIELD(gpu.key_line));
+    io_set(emu, GB_IO_CPU_IF, NULL, NULL, IO_FIELD(cpu.int_flags));
+    io_set(emu, GB_IO_BIOS_FLAG, NULL, io_bios_flag_write, 0);
+
+    io_set(emu, GB_IO_TIMER_DIV, NULL, io_div_write, IO_FIELD(timer.div));
+    io_set(emu, GB_IO_TIMER_TIMA, NULL, io_tima_write, IO_FIELD(timer.tima));
+    io_set(emu, GB_IO_TIMER_TMA, NULL, NULL, IO_FIELD(timer.tma));
+    io_set(emu, GB_IO_TIMER_TAC, NULL, io_tac_write, IO_FIELD(timer.tac));
+
+    for (addr = 0xFF10; addr <= 0xFF3F; addr++)
+        io_set(emu, addr, io_sound_read, io_sound_write, 0);
+
+    io_set(emu, GB_IO_GPU_CTL, NULL, io_ctl_write, IO_FIELD(gpu.ctl));
+    io_set(emu, GB_IO_GPU_STATUS, io_status_read, io_status_write, 0);
+    io_set(emu, GB_IO_GPU_SCRY, NULL, NULL, IO_FIELD(gpu.scroll_y));
+    io_set(emu, GB_IO_GPU_SCRX, NULL, NULL, IO_FIELD(gpu.scroll_x));
+    io_set(emu, GB_IO_GPU_LY, NULL, io_ly_write, IO_FIELD(gpu.cur_line));
+    io_set(emu, GB_IO_GPU_LYC, NULL, NULL, IO_FIELD(gpu.cur_line_cmp));
+    io_set(emu, GB_IO_GPU_DMA, NULL, io_dma_write, 0);
+    io_set(emu, GB_IO_GPU_PALETTE, NULL, io_palette_write, IO_FIELD(gpu.back_palette));
+    io_set(emu, GB_IO_OBJ_PAL1, NULL, io_palette_write, IO_FIELD(gpu.obj_pal[0]));
+    io_set(emu, GB_IO_OBJ_PAL2, NULL, io_palette_write, IO_FIELD(gpu.obj_pal[1]));
+    io_set(emu, GB_IO_GPU_WY, NULL, NULL, IO_FIELD(gpu.window_y));
+    io_set(emu, GB_IO_GPU_WX, NULL, NULL, IO_FIELD(gpu.window_x));
 
-        if (emu->gpu.cgb_bkgd_palette_index & GB_GPU_CGB_PAL_INDEX_AUTO_INCREMENT)
-            emu->gpu.cgb_bkgd_palette_index = (emu->gpu.cgb_bkgd_palette_index + 1) & 0xBF;
+    if (!gb_emu_is_cgb(emu))
+        return ;
 
-        break;
+    io_set(emu, GB_IO_CPU_CGB_KEY1, io_key1_read, io_key1_write, 0);
+    io_set(emu, GB_IO_CGB_VRAM_BANK_NO, io_vram_bank_read, io_vram_bank_write, 0);
+    io_set(emu, GB_IO_CGB_WRAM_BANK_NO, io_wram_bank_read, io_wram_bank_write, 0);
 
-    case GB_IO_CGB_SPRITE_PAL_INDEX:
-        emu->gpu.cgb_sprite_palette_index = byte;
-        break;
+    io_set(emu, GB_IO_CGB_HDMA_SOURCE_HIGH, io_hdma_read, io_hdma_write, 0);
+    io_set(emu, GB_IO_CGB_HDMA_SOURCE_LOW, io_hdma_read, io_hdma_write, 0);
+    io_set(emu, GB_IO_CGB_HDMA_DEST_HIGH, io_hdma_read, io_hdma_write, 0);
+    io_set(emu, GB_IO_CGB_HDMA_DEST_LOW, io_hdma_read, io_hdma_write, 0);
+    io_set(emu, GB_IO_CGB_HDMA_MODE, io_hdma_read, io_hdma_mode_write, 0);
 
-    case GB_IO_CGB_SPRITE_PAL_DATA:
-        emu->gpu.cgb_sprite_palette[emu->gpu.cgb_sprite_palette_index & 0x3F] = byte;
+    io_set(emu, GB_IO_CGB_BG_PAL_INDEX, io_bg_pal_index_read, io_bg_pal_index_write, 0);
+    io_set(emu, GB_IO_CGB_BG_PAL_DATA, io_bg_pal_data_read, io_bg_pal_data_write, 0);
+    io_set(emu, GB_IO_CGB_SPRITE_PAL_INDEX, io_sprite_pal_index_read, io_sprite_pal_index_write, 0);
+    io_set(emu, GB_IO_CGB_SPRITE_PAL_DATA, io_sprite_pal_data_read, io_sprite_pal_data_write, 0);
+}
 
-        if (emu->gpu.cgb_sprite_palette_index & GB_GPU_CGB_PAL_INDEX_AUTO_INCREMENT)
-            emu->gpu.cgb_sprite_palette_index = (emu->gpu.cgb_sprite_palette_index + 1) & 0xBF;
+void gb_emu_io_reset(struct gb_emu *emu)
+{
+    gb_gpu_render_sync(&emu->gpu);
 
-        break;
+    io_setup_regs(emu);
 
-    case GB_IO_CGB_HDMA_SOURCE_LOW:
-        emu->mmu.hdma_source = (emu->mmu.hdma_source & 0xFF00) | (byte & 0xF0);
-        break;
+    emu->gpu.ctl = 0x91;
+    emu->gpu.sprites_dirty = 1;
 
-    case GB_IO_CGB_HDMA_SOURCE_HIGH:
-        emu->mmu.hdma_source = (emu->mmu.hdma_source & 0x00FF) | (byte << 8);
-        break;
+    emu->gpu.cur_line = 0;
+    emu->gpu.cur_line_cmp = 0;
+    emu->gpu.scroll_x = 0;
+    emu->gpu.scroll_y = 0;
+    emu->gpu.status = 0;
 
-    case GB_IO_CGB_HDMA_DEST_LOW:
-        emu->mmu.hdma_dest = (emu->mmu.hdma_dest & 0xFF00) | (byte & 0xF0);
-        break;
+    emu->gpu.window_x = 0;
+    emu->gpu.window_y = 0;
 
-    case GB_IO_CGB_HDMA_DEST_HIGH:
-        emu->mmu.hdma_dest = (emu->mmu.hdma_dest & 0x00FF) | ((byte & 0x1F) << 8) | 0x8000;
-        break;
+    emu->gpu.back_palette = 0xE4;
+    gb_gpu_palettes_flush(&emu->gpu);
 
-    case GB_IO_CGB_HDMA_MODE:
-        if (emu->mmu.hdma_active) {
-            if ((byte & GB_CGB_HDMA_DMA_TYPE) == 0)
-                emu->mmu.hdma_active = 0;
-            break;
-        }
+    emu->gpu.cgb_vram_bank_no = 0;
+    emu->mmu.cgb_wram_bank_no = 1;
 
-        emu->mmu.hdma_type = byte & GB_CGB_HDMA_DMA_TYPE;
-        emu->mmu.hdma_length_left = ((byte & 0x7F) + 1) * 0x10;
-        emu->mmu.hdma_active = 1;
+    emu->timer.div = 0;
+    emu->timer.tima = 0;
+    emu->timer.tma = 0;
+    emu->timer.tac = 0;
+}
 
-        if (emu->mmu.hdma_type == GB_CGB_HDMA_DMA_GENERAL) {
-            while (emu->mmu.hdma_length_left) {
-                if ((emu->mmu.hdma_length_left % 2) == 0)
-                    gb_emu_clock_tick(emu);
-                emu->gpu.vram[emu->gpu.cgb_vram_bank_no].mem[emu->mmu.hdma_dest - 0x8000] = gb_emu_read8(emu, emu->mmu.hdma_source);
+uint8_t gb_emu_io_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    struct gb_io_reg *reg = emu->io.regs + addr;
 
-                emu->mmu.hdma_dest++;
-                emu->mmu.hdma_source++;
-                emu->mmu.hdma_length_left--;
-            }
+    if (reg->read8)
+        return (reg->read8) (emu, addr);
 
-            emu->mmu.hdma_active = 0;
-            emu->mmu.hdma_length_left = 0xFF;
-        }
-        break;
+    if (reg->offset)
+        return *((uint8_t *)emu + reg->offset);
 
-    case GB_IO_CPU_CGB_KEY1:
-        emu->cpu.do_speed_switch = byte & 1;
-        break;
-    }
+    return 0xFF;
 }
 
+void gb_emu_io_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t byte)
+{
+    struct gb_io_reg *reg = emu->io.regs + addr;
+
+    if (reg->write8)
+        (reg->write8) (emu, addr, byte);
+    else if (reg->offset)
+        *((uint8_t *)emu + reg->offset) = byte;
+}
@@ -0,0 +1,155 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gb.h"
+#include "gb/mmu.h"
+#include "gb/fastmem.h"
+#include "debug.h"
+
+/*
+ * Fast memory - The ROM mapped into a host region with mmap(), so that reading
+ * it is a single load from 'base + addr' rather then a call through the MMU.
+ *
+ * Which part of the ROM each page shows is taken from the MBC's get_page(), so
+ * every MBC with one works as-is. The pages are only remapped when that
+ * changes, which happens after a write to the MBC marks the mapping stale.
+ * Pages that aren't backed by the ROM (The BIOS, or a bank past the end of it)
+ * are simply left unreadable.
+ */
+
+static uint8_t *fastmem_reserve(void)
+{
+    uint8_t *region, *base;
+    size_t head;
+
+    /* Reserve twice the size, so a 64KB aligned piece can be cut out of it */
+    region = mmap(NULL, GB_FASTMEM_SIZE * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+
+    base = (uint8_t *)(((uintptr_t)region + GB_FASTMEM_SIZE - 1) & ~(uintptr_t)(GB_FASTMEM_SIZE - 1));
+    head = base - region;
+
+    if (head)
+        munmap(region, head);
+
+    munmap(base + GB_FASTMEM_SIZE, GB_FASTMEM_SIZE - head);
+
+    return base;
+}
+
+int gb_fastmem_init(struct gb_emu *emu)
+{
+    struct gb_fastmem *fastmem = &emu->mmu.fastmem;
+    int i;
+
+    memset(fastmem, 0, sizeof(*fastmem));
+    fastmem->rom_fd = -1;
+
+    for (i = 0; i < GB_FASTMEM_PAGES; i++)
+        fastmem->offsets[i] = -1;
+
+    if (sysconf(_SC_PAGESIZE) != GB_FASTMEM_PAGE_SIZE || !emu->rom.length)
+        return 1;
+
+    fastmem->rom_fd = memfd_create("gbemuc-rom", MFD_CLOEXEC);
+    if (fastmem->rom_fd == -1)
+        goto fail;
+
+    if (write(fastmem->rom_fd, emu->rom.data, emu->rom.length) != (ssize_t)emu->rom.length)
+        goto fail;
+
+    fastmem->base = fastmem_reserve();
+    if (!fastmem->base)
+        goto fail;
+
+    fastmem->stale = 1;
+    return 0;
+
+  fail:
+    printf("Unable to map the ROM for fast memory, it will not be used\n");
+    gb_fastmem_clear(fastmem);
+    return 1;
+}
+
+void gb_fastmem_clear(struct gb_fastmem *fastmem)
+{
+    if (fastmem->base)
+        munmap(fastmem->base, GB_FASTMEM_SIZE);
+
+    if (fastmem->rom_fd != -1)
+        close(fastmem->rom_fd);
+
+    fastmem->base = NULL;
+    fastmem->rom_fd = -1;
+    fastmem->readable = 0;
+    fastmem->stale = 0;
+}
+
+/* Returns the ROM offset that should be mapped at page 'page', or -1 if it
+ * isn't a whole page of the ROM */
+static long fastmem_page_offset(struct gb_emu *emu, int page)
+{
+    struct gb_mmu_entry *entry = emu->mmu.mbc_controller;
+    const uint8_t *ptr, *data = (const uint8_t *)emu->rom.data;
+    long offset;
+
+    if (!entry || !entry->get_page)
+        return -1;
+
+    ptr = (entry->get_page) (emu, page * GB_FASTMEM_PAGE_SIZE - entry->low, entry->low);
+    if (!ptr || ptr < data || ptr >= data + emu->rom.length)
+        return -1;
+
+    offset = ptr - data;
+    if (offset % GB_FASTMEM_PAGE_SIZE || offset + GB_FASTMEM_PAGE_SIZE > (long)emu->rom.length)
+        return -1;
+
+    /* The BIOS only covers part of the first page, so it can't be mapped */
+    if (page == 0 && !emu->mmu.bios_flag)
+        return -1;
+
+    return offset;
+}
+
+/* Brings the mapping up to date with the MBC */
+void gb_fastmem_sync(struct gb_emu *emu)
+{
+    struct gb_fastmem *fastmem = &emu->mmu.fastmem;
+    uint16_t readable = 0;
+    int i;
+
+    fastmem->stale = 0;
+
+    if (!fastmem->base)
+        return ;
+
+    for (i = 0; i < GB_FASTMEM_PAGES; i++) {
+        long offset = fastmem_page_offset(emu, i);
+
+        if (offset == -1)
+            continue;
+
+        if (offset != fastmem->offsets[i]) {
+            void *page = fastmem->base + i * GB_FASTMEM_PAGE_SIZE;
+
+            if (mmap(page, GB_FASTMEM_PAGE_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED, fastmem->rom_fd, offset) == MAP_FAILED) {
+                fastmem->offsets[i] = -1;
+                continue;
+            }
+
+            DEBUG_PRINTF("Fastmem: 0x%04x -> ROM 0x%06lx\n", i * GB_FASTMEM_PAGE_SIZE, offset);
+            fastmem->offsets[i] = offset;
+        }
+
+        readable |= 1 << i;
+    }
+
+    fastmem->readable = readable;
+}
@@ -21,6 +21,14 @@ static uint8_t mbc0_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
     return emu->rom.data[addr];
 }
 
+static const uint8_t *mbc0_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios;
+
+    return gb_mmu_rom_page(emu, addr);
+}
+
 static void mbc0_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t val)
 {
     /* NOP */
@@ -36,7 +44,16 @@ static void mbc0_eram_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, ui
     /* NOP */
 }
 
+/* Without an MBC, bank 1 is always the one at 0x4000 */
 static int mbc0_get_bank(struct gb_emu *emu, uint16_t addr)
+{
+    if (addr >= 0x4000)
+        return 1;
+
+    return 0;
+}
+
+static int mbc0_eram_get_bank(struct gb_emu *emu, uint16_t addr)
 {
     return 0;
 }
@@ -47,6 +64,7 @@ struct gb_mmu_entry gb_mbc0_mmu_entry = {
     .read8 = mbc0_read8,
     .write8 = mbc0_write8,
     .get_bank = mbc0_get_bank,
+    .get_page = mbc0_get_page,
 };
 
 struct gb_mmu_entry gb_mbc0_eram_mmu_entry = {
@@ -54,6 +72,6 @@ struct gb_mmu_entry gb_mbc0_eram_mmu_entry = {
     .high = 0xBFFF,
     .read8 = mbc0_eram_read8,
     .write8 = mbc0_eram_write8,
-    .get_bank = mbc0_get_bank,
+    .get_bank = mbc0_eram_get_bank,
 };
 
@@ -28,22 +28,32 @@ static inline int bank_number(struct gb_emu *emu)
     return bank_no;
 }
 
+static inline int data_offset(struct gb_emu *emu, uint16_t addr)
+{
+    int offset = addr;
+
+    if (addr >= 0x4000) {
+        offset &= 0x3FFF;
+        offset += bank_number(emu) * 0x4000;
+    }
+
+    return offset;
+}
+
 static uint8_t mbc1_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 {
-    if (!emu->mmu.bios_flag && addr < 0x0100) {
+    if (!emu->mmu.bios_flag && addr < 0x0100)
         return gb_bios[addr];
-    } else {
-        uint16_t bank_no = 0;
-        int data_offset = addr;
-
-        if (addr >= 0x4000) {
-            bank_no = bank_number(emu);
-            data_offset &= 0x3FFF;
-            data_offset += bank_no * 0x4000;
-        }
+    else
+        return emu->rom.data[data_offset(emu, addr)];
+}
 
-        return emu->rom.data[data_offset];
-    }
+static const uint8_t *mbc1_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios;
+    else
+        return gb_mmu_rom_page(emu, data_offset(emu, addr));
 }
 
 static void mbc1_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t val)
@@ -91,6 +101,14 @@ static void mbc1_eram_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, ui
         emu->mmu.eram[0][addr] = val;
 }
 
+static const uint8_t *mbc1_eram_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (emu->mmu.mbc1.rom_ram_mode)
+        return (const uint8_t *)emu->mmu.eram[emu->mmu.mbc1.ram_rom_bank_upper] + addr;
+    else
+        return (const uint8_t *)emu->mmu.eram[0] + addr;
+}
+
 static int mbc1_get_bank(struct gb_emu *emu, uint16_t addr)
 {
     if (addr >= 0x4000)
@@ -113,6 +131,7 @@ struct gb_mmu_entry gb_mbc1_mmu_entry = {
     .read8 = mbc1_read8,
     .write8 = mbc1_write8,
     .get_bank = mbc1_get_bank,
+    .get_page = mbc1_get_page,
 };
 
 struct gb_mmu_entry gb_mbc1_eram_mmu_entry = {
@@ -121,5 +140,6 @@ struct gb_mmu_entry gb_mbc1_eram_mmu_entry = {
     .read8 = mbc1_eram_read8,
     .write8 = mbc1_eram_write8,
     .get_bank = mbc1_eram_get_bank,
+    .get_page = mbc1_eram_get_page,
 };
 
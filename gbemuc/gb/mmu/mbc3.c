@@ -27,22 +27,32 @@ static inline int bank_number(struct gb_emu *emu)
     return bank_no;
 }
 
+static inline int data_offset(struct gb_emu *emu, uint16_t addr)
+{
+    int offset = addr;
+
+    if (addr >= 0x4000) {
+        offset &= 0x3FFF;
+        offset += bank_number(emu) * 0x4000;
+    }
+
+    return offset;
+}
+
 static uint8_t mbc3_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 {
-    if (!emu->mmu.bios_flag && addr < 0x0100) {
+    if (!emu->mmu.bios_flag && addr < 0x0100)
         return gb_bios[addr];
-    } else {
-        uint16_t bank_no = 0;
-        int data_offset = addr;
-
-        if (addr >= 0x4000) {
-            bank_no = bank_number(emu);
-            data_offset &= 0x3FFF;
-            data_offset += bank_no * 0x4000;
-        }
+    else
+        return emu->rom.data[data_offset(emu, addr)];
+}
 
-        return emu->rom.data[data_offset];
-    }
+static const uint8_t *mbc3_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios;
+    else
+        return gb_mmu_rom_page(emu, data_offset(emu, addr));
 }
 
 static void mbc3_update_time(struct gb_mmu *mmu)
@@ -153,6 +163,15 @@ static uint8_t mbc3_eram_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
     return 0;
 }
 
+/* The RTC registers can only be read through mbc3_eram_read8() */
+static const uint8_t *mbc3_eram_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (emu->mmu.mbc3.ram_timer_enable == 0x0A && emu->mmu.mbc3.ram_bank < 0x04)
+        return (const uint8_t *)emu->mmu.eram[emu->mmu.mbc3.ram_bank] + addr;
+
+    return NULL;
+}
+
 static void mbc3_eram_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t val)
 {
     if (!(emu->mmu.mbc3.ram_timer_enable == 0x0A))
@@ -201,6 +220,7 @@ struct gb_mmu_entry gb_mbc3_mmu_entry = {
     .read8 = mbc3_read8,
     .write8 = mbc3_write8,
     .get_bank = mbc3_get_bank,
+    .get_page = mbc3_get_page,
 };
 
 struct gb_mmu_entry gb_mbc3_eram_mmu_entry = {
@@ -209,5 +229,6 @@ struct gb_mmu_entry gb_mbc3_eram_mmu_entry = {
     .read8 = mbc3_eram_read8,
     .write8 = mbc3_eram_write8,
     .get_bank = mbc3_eram_get_bank,
+    .get_page = mbc3_eram_get_page,
 };
 
@@ -14,25 +14,35 @@
  *
  */
 
-static uint8_t mbc5_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
+static inline int data_offset(struct gb_emu *emu, uint16_t addr)
 {
-    if (!emu->mmu.bios_flag && addr < 0x0100) {
-        return gb_bios[addr];
-    } else {
-        uint16_t bank_no = 0;
-        int data_offset = addr;
-
-        if (addr >= 0x4000) {
-            bank_no = emu->mmu.mbc5.rom_bank;
-            data_offset &= 0x3FFF;
+    int offset = addr;
 
-            data_offset += bank_no * 0x4000;
+    if (addr >= 0x4000) {
+        offset &= 0x3FFF;
 
-            data_offset %= gb_rom_size[emu->rom.rom_size] * 1024;
-        }
+        offset += emu->mmu.mbc5.rom_bank * 0x4000;
 
-        return emu->rom.data[data_offset];
+        offset %= gb_rom_size[emu->rom.rom_size] * 1024;
     }
+
+    return offset;
+}
+
+static uint8_t mbc5_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios[addr];
+    else
+        return emu->rom.data[data_offset(emu, addr)];
+}
+
+static const uint8_t *mbc5_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!emu->mmu.bios_flag && addr < 0x0100)
+        return gb_bios;
+    else
+        return gb_mmu_rom_page(emu, data_offset(emu, addr));
 }
 
 static void mbc5_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t val)
@@ -71,6 +81,14 @@ static uint8_t mbc5_eram_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
     return emu->mmu.eram[emu->mmu.mbc5.ram_bank][addr];
 }
 
+static const uint8_t *mbc5_eram_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (emu->mmu.mbc5.ram_bank_enable == 0x0A)
+        return (const uint8_t *)emu->mmu.eram[emu->mmu.mbc5.ram_bank] + addr;
+
+    return NULL;
+}
+
 static void mbc5_eram_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, uint8_t val)
 {
     if (emu->mmu.mbc5.ram_bank_enable == 0x0A) {
@@ -101,6 +119,7 @@ struct gb_mmu_entry gb_mbc5_mmu_entry = {
     .read8 = mbc5_read8,
     .write8 = mbc5_write8,
     .get_bank = mbc5_get_bank,
+    .get_page = mbc5_get_page,
 };
 
 struct gb_mmu_entry gb_mbc5_eram_mmu_entry = {
@@ -109,5 +128,6 @@ struct gb_mmu_entry gb_mbc5_eram_mmu_entry = {
     .read8 = mbc5_eram_read8,
     .write8 = mbc5_eram_write8,
     .get_bank = mbc5_eram_get_bank,
+    .get_page = mbc5_eram_get_page,
 };
 
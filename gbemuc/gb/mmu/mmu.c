@@ -28,6 +28,11 @@ static void wram_bank0_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, u
     emu->mmu.wram[0][addr] = val;
 }
 
+static const uint8_t *wram_bank0_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    return (const uint8_t *)emu->mmu.wram[0] + addr;
+}
+
 static uint8_t wram_bank1_read8(struct gb_emu *emu, uint16_t addr, uint16_t low)
 {
     if (!gb_emu_is_cgb(emu) || emu->mmu.cgb_wram_bank_no == 0)
@@ -44,6 +49,14 @@ static void wram_bank1_write8(struct gb_emu *emu, uint16_t addr, uint16_t low, u
         emu->mmu.wram[emu->mmu.cgb_wram_bank_no][addr] = val;
 }
 
+static const uint8_t *wram_bank1_get_page(struct gb_emu *emu, uint16_t addr, uint16_t low)
+{
+    if (!gb_emu_is_cgb(emu) || emu->mmu.cgb_wram_bank_no == 0)
+        return (const uint8_t *)emu->mmu.wram[1] + addr;
+    else
+        return (const uint8_t *)emu->mmu.wram[emu->mmu.cgb_wram_bank_no] + addr;
+}
+
 /*
  *
  * Z-RAM
@@ -98,17 +111,17 @@ static struct gb_mmu_entry mmu_entries[] = {
 
     [GB_MMU_WRAM_BANK0] =
         { 0xC000, 0xCFFF,
-            wram_bank0_read8, wram_bank0_write8, NULL },
+            wram_bank0_read8, wram_bank0_write8, NULL, wram_bank0_get_page },
     [GB_MMU_WRAM_BANK1] =
         { 0xD000, 0xDFFF,
-            wram_bank1_read8, wram_bank1_write8, NULL },
+            wram_bank1_read8, wram_bank1_write8, NULL, wram_bank1_get_page },
 
     [GB_MMU_WRAM_ECHO_BANK0] =
         { 0xE000, 0xEFFF,
-            wram_bank0_read8, wram_bank0_write8, NULL },
+            wram_bank0_read8, wram_bank0_write8, NULL, wram_bank0_get_page },
     [GB_MMU_WRAM_ECHO_BANK1] =
         { 0xF000, 0xFDFF,
-            wram_bank1_read8, wram_bank1_write8, NULL },
+            wram_bank1_read8, wram_bank1_write8, NULL, wram_bank1_get_page },
 
     [GB_MMU_SPRITE] =
         { 0xFE00, 0xFE9F,
@@ -198,7 +211,17 @@ static inline struct gb_mmu_entry *get_mmu_entry(struct gb_emu *emu, uint16_t ad
 
 uint8_t gb_emu_read8(struct gb_emu *emu, uint16_t addr)
 {
-    struct gb_mmu_entry *entry = get_mmu_entry(emu, addr);
+    struct gb_mmu_entry *entry;
+
+#ifdef CONFIG_FASTMEM
+    if (emu->mmu.fastmem.stale)
+        gb_fastmem_sync(emu);
+
+    if (gb_fastmem_readable(&emu->mmu.fastmem, addr))
+        return emu->mmu.fastmem.base[addr];
+#endif
+
+    entry = get_mmu_entry(emu, addr);
 
     if (entry)
         return (entry->read8) (emu, addr - entry->low, entry->low);
@@ -208,7 +231,17 @@ uint8_t gb_emu_read8(struct gb_emu *emu, uint16_t addr)
 
 uint16_t gb_emu_read16(struct gb_emu *emu, uint16_t addr)
 {
-    struct gb_mmu_entry *entry = get_mmu_entry(emu, addr);
+    struct gb_mmu_entry *entry;
+
+#ifdef CONFIG_FASTMEM
+    if (emu->mmu.fastmem.stale)
+        gb_fastmem_sync(emu);
+
+    if (gb_fastmem_readable(&emu->mmu.fastmem, addr) && gb_fastmem_readable(&emu->mmu.fastmem, addr + 1))
+        return emu->mmu.fastmem.base[addr] | (emu->mmu.fastmem.base[addr + 1] << 8);
+#endif
+
+    entry = get_mmu_entry(emu, addr);
 
     if (entry)
         return ((entry->read8) (emu, addr - entry->low, entry->low))
@@ -221,6 +254,13 @@ void gb_emu_write8(struct gb_emu *emu, uint16_t addr, uint8_t byte)
 {
     struct gb_mmu_entry *entry = get_mmu_entry(emu, addr);
 
+    if (emu->mmu.dirty_pages)
+        emu->mmu.dirty_pages[addr >> 8] = 1;
+
+    /* Writes to ROM go to the MBC, which may switch banks */
+    if (addr < 0x8000)
+        gb_mmu_fetch_flush(&emu->mmu);
+
     if (entry)
         (entry->write8) (emu, addr - entry->low, entry->low, byte);
 }
@@ -229,18 +269,66 @@ void gb_emu_write16(struct gb_emu *emu, uint16_t addr, uint16_t word)
 {
     struct gb_mmu_entry *entry = get_mmu_entry(emu, addr);
 
+    if (emu->mmu.dirty_pages) {
+        emu->mmu.dirty_pages[addr >> 8] = 1;
+        emu->mmu.dirty_pages[(uint16_t)(addr + 1) >> 8] = 1;
+    }
+
+    if (addr < 0x8000)
+        gb_mmu_fetch_flush(&emu->mmu);
+
     if (entry) {
         (entry->write8) (emu, addr - entry->low, entry->low, word & 0xFF);
         (entry->write8) (emu, addr - entry->low + 1, entry->low, word >> 8);
     }
 }
 
+/*
+ * Code is fetched through a pointer to the 256 byte page PC was last in,
+ * rather then going through the MMU for every byte. The pointer is looked up
+ * again whenever PC moves to another page, and dropped by gb_mmu_fetch_flush()
+ * when the mapping changes. Pages without a get_page() go through the MMU as
+ * usual.
+ */
+static uint8_t fetch_slow(struct gb_emu *emu, uint16_t addr)
+{
+    struct gb_mmu_entry *entry = get_mmu_entry(emu, addr);
+    const uint8_t *page = NULL;
+
+    if (!entry)
+        return 0;
+
+    if (entry->get_page)
+        page = (entry->get_page) (emu, (addr & 0xFF00) - entry->low, entry->low);
+
+    if (!page)
+        return (entry->read8) (emu, addr - entry->low, entry->low);
+
+    emu->mmu.fetch_ptr = page;
+    emu->mmu.fetch_page = addr >> 8;
+
+    return page[addr & 0xFF];
+}
+
+static inline uint8_t fetch8(struct gb_emu *emu, uint16_t addr)
+{
+    if (emu->mmu.fetch_ptr && emu->mmu.fetch_page == (addr >> 8))
+        return emu->mmu.fetch_ptr[addr & 0xFF];
+
+    return fetch_slow(emu, addr);
+}
+
 uint8_t gb_emu_next_pc8(struct gb_emu *emu)
 {
     uint16_t addr = emu->cpu.r.w[GB_REG_PC];
     emu->cpu.r.w[GB_REG_PC]++;
 
-    return gb_emu_read8(emu, addr);
+    return fetch8(emu, addr);
+}
+
+uint8_t gb_emu_peek_pc8(struct gb_emu *emu)
+{
+    return fetch8(emu, emu->cpu.r.w[GB_REG_PC]);
 }
 
 uint16_t gb_emu_next_pc16(struct gb_emu *emu)
@@ -248,7 +336,47 @@ uint16_t gb_emu_next_pc16(struct gb_emu *emu)
     uint16_t addr = emu->cpu.r.w[GB_REG_PC];
     emu->cpu.r.w[GB_REG_PC] += 2;
 
-    return gb_emu_read16(emu, addr);
+    /* gb_emu_read16() reads both bytes through the first byte's entry, which
+     * differs from two reads at the end of a region */
+    if ((addr & 0xFF) == 0xFF)
+        return gb_emu_read16(emu, addr);
+
+    return fetch8(emu, addr) | (fetch8(emu, addr + 1) << 8);
+}
+
+/* Returns the ROM data at 'data_offset', for the MBCs' get_page(), if the
+ * whole page is inside of the ROM */
+const uint8_t *gb_mmu_rom_page(struct gb_emu *emu, int data_offset)
+{
+    if (data_offset < 0 || (size_t)data_offset + 0x100 > emu->rom.length)
+        return NULL;
+
+    return (const uint8_t *)emu->rom.data + data_offset;
+}
+
+/* Returns where the byte at 'addr' can be read from directly, along with the
+ * rest of its 256 byte page, or NULL if it has to go through the MMU. Used by
+ * the DMA transfers to copy a whole span at once. The pointer is only good
+ * until the mapping changes. */
+const uint8_t *gb_mmu_read_ptr(struct gb_emu *emu, uint16_t addr)
+{
+    struct gb_mmu_entry *entry;
+    const uint8_t *page;
+
+    /* VRAM has no get_page(), since a bank switch doesn't flush the fetch
+     * pointer - it's only ever looked up here */
+    if (addr >= 0x8000 && addr < 0xA000)
+        return emu->gpu.vram[emu->gpu.cgb_vram_bank_no].mem + (addr - 0x8000);
+
+    entry = get_mmu_entry(emu, addr);
+    if (!entry || !entry->get_page)
+        return NULL;
+
+    page = (entry->get_page) (emu, (addr & 0xFF00) - entry->low, entry->low);
+    if (!page)
+        return NULL;
+
+    return page + (addr & 0xFF);
 }
 
 int gb_emu_addr_is_rom(struct gb_emu *emu, uint16_t addr)
@@ -0,0 +1,104 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gb/disasm.h"
+#include "gb/pair_profile.h"
+#include "gb.h"
+
+/*
+ * Instruction pair profiling.
+ *
+ * Every instruction run through the interpreter is paired up with the one run
+ * before it, and the most common pairs are displayed at the end. These are
+ * the pairs worth fusing in the interpreter. A pair is only counted if no
+ * interrupt was taken between the two instructions.
+ *
+ * This uses the CPU hooks, so the interpreter runs every instruction
+ * separately while the profile is running, even with the JIT.
+ */
+
+static void pair_profile_next_inst(struct gb_cpu_hooks *hooks, struct gb_emu *emu, uint8_t *inst)
+{
+    struct gb_pair_profile *profile = container_of(hooks, struct gb_pair_profile, hooks);
+
+    if (profile->last_opcode != -1 && profile->end_pc == emu->cpu.r.w[GB_REG_PC]) {
+        profile->counts[profile->last_opcode][inst[0]]++;
+        profile->total++;
+    }
+
+    memcpy(profile->last_inst[inst[0]], inst, 3);
+    profile->last_opcode = inst[0];
+}
+
+static void pair_profile_end_inst(struct gb_cpu_hooks *hooks, struct gb_emu *emu)
+{
+    struct gb_pair_profile *profile = container_of(hooks, struct gb_pair_profile, hooks);
+
+    profile->end_pc = emu->cpu.r.w[GB_REG_PC];
+}
+
+struct gb_pair_profile *gb_pair_profile_start(struct gb_emu *emu)
+{
+    struct gb_pair_profile *profile = calloc(1, sizeof(*profile));
+
+    profile->hooks.next_inst = pair_profile_next_inst;
+    profile->hooks.end_inst = pair_profile_end_inst;
+    profile->last_opcode = -1;
+
+    emu->cpu.hooks = &profile->hooks;
+    emu->hook_flag = 1;
+
+    return profile;
+}
+
+void gb_pair_profile_print(struct gb_pair_profile *profile, FILE *file)
+{
+    uint64_t shown[GB_PAIR_PROFILE_TOP] = { 0 };
+    int pairs[GB_PAIR_PROFILE_TOP];
+    int i, k, count = 0;
+
+    /* Insertion sort into the top list, smallest last */
+    for (i = 0; i < 256 * 256; i++) {
+        uint64_t c = profile->counts[i >> 8][i & 0xFF];
+
+        if (!c || (count == GB_PAIR_PROFILE_TOP && c <= shown[count - 1]))
+            continue;
+
+        if (count < GB_PAIR_PROFILE_TOP)
+            count++;
+
+        for (k = count - 1; k > 0 && shown[k - 1] < c; k--) {
+            shown[k] = shown[k - 1];
+            pairs[k] = pairs[k - 1];
+        }
+
+        shown[k] = c;
+        pairs[k] = i;
+    }
+
+    fprintf(file, "Instruction pairs: %llu total\n", (unsigned long long)profile->total);
+
+    for (i = 0; i < count; i++) {
+        char first[30] = { 0 }, second[30] = { 0 };
+
+        gb_disasm_inst(first, profile->last_inst[pairs[i] >> 8]);
+        gb_disasm_inst(second, profile->last_inst[pairs[i] & 0xFF]);
+
+        fprintf(file, "%5.2f%% (0x%02x, 0x%02x) %-20s %s\n",
+                (double)shown[i] * 100 / profile->total, pairs[i] >> 8, pairs[i] & 0xFF, first, second);
+    }
+}
+
+void gb_pair_profile_stop(struct gb_emu *emu, struct gb_pair_profile *profile)
+{
+    emu->cpu.hooks = NULL;
+    emu->hook_flag = 0;
+
+    free(profile);
+}
@@ -0,0 +1,137 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "gb.h"
+#include "gb/gpu.h"
+#include "gb/render_thread.h"
+#include "debug.h"
+
+/*
+ * The render thread - See gb/render_thread.h.
+ *
+ * 'head' and 'tail' are only touched with the lock held. The GPU's
+ * 'render_pending' is kept as well so that gb_gpu_render_sync() can check for
+ * queued lines without taking the lock, which it does on every VRAM write.
+ */
+
+static void *render_thread_run(void *data)
+{
+    struct gb_render_thread *render = data;
+    struct gb_emu *emu = render->emu;
+
+    pthread_mutex_lock(&render->lock);
+
+    while (1) {
+        struct gb_gpu_line_regs regs;
+
+        while (render->head == render->tail && !render->exit)
+            pthread_cond_wait(&render->queued, &render->lock);
+
+        if (render->head == render->tail)
+            break;
+
+        regs = render->lines[render->head % GB_SCREEN_HEIGHT];
+
+        pthread_mutex_unlock(&render->lock);
+        gb_gpu_render_line_regs(emu, &emu->gpu, &regs);
+        pthread_mutex_lock(&render->lock);
+
+        render->head++;
+        __atomic_sub_fetch(&emu->gpu.render_pending, 1, __ATOMIC_RELEASE);
+
+        if (render->head == render->tail)
+            pthread_cond_broadcast(&render->done);
+    }
+
+    pthread_mutex_unlock(&render->lock);
+
+    return NULL;
+}
+
+void gb_render_thread_queue(struct gb_render_thread *render, const struct gb_gpu_line_regs *regs)
+{
+    pthread_mutex_lock(&render->lock);
+
+    /* Only possible if the screen wasn't synced at the end of a frame */
+    while (render->tail - render->head == GB_SCREEN_HEIGHT)
+        pthread_cond_wait(&render->done, &render->lock);
+
+    render->lines[render->tail % GB_SCREEN_HEIGHT] = *regs;
+    render->tail++;
+    __atomic_add_fetch(&render->emu->gpu.render_pending, 1, __ATOMIC_RELEASE);
+
+    pthread_cond_signal(&render->queued);
+    pthread_mutex_unlock(&render->lock);
+}
+
+void gb_render_thread_wait(struct gb_render_thread *render)
+{
+    pthread_mutex_lock(&render->lock);
+
+    while (render->head != render->tail)
+        pthread_cond_wait(&render->done, &render->lock);
+
+    pthread_mutex_unlock(&render->lock);
+}
+
+int gb_render_thread_start(struct gb_emu *emu)
+{
+    struct gb_render_thread *render;
+
+    if (emu->gpu.render_thread)
+        return 0;
+
+    render = malloc(sizeof(*render));
+    memset(render, 0, sizeof(*render));
+
+    render->emu = emu;
+    pthread_mutex_init(&render->lock, NULL);
+    pthread_cond_init(&render->queued, NULL);
+    pthread_cond_init(&render->done, NULL);
+
+    if (pthread_create(&render->thread, NULL, render_thread_run, render)) {
+        printf("Unable to start the render thread, lines will be drawn as they're reached\n");
+
+        pthread_cond_destroy(&render->done);
+        pthread_cond_destroy(&render->queued);
+        pthread_mutex_destroy(&render->lock);
+        free(render);
+        return 1;
+    }
+
+    emu->gpu.render_pending = 0;
+    emu->gpu.render_thread = render;
+
+    DEBUG_PRINTF("Render thread started\n");
+
+    return 0;
+}
+
+void gb_render_thread_stop(struct gb_emu *emu)
+{
+    struct gb_render_thread *render = emu->gpu.render_thread;
+
+    if (!render)
+        return ;
+
+    pthread_mutex_lock(&render->lock);
+    render->exit = 1;
+    pthread_cond_signal(&render->queued);
+    pthread_mutex_unlock(&render->lock);
+
+    pthread_join(render->thread, NULL);
+
+    pthread_cond_destroy(&render->done);
+    pthread_cond_destroy(&render->queued);
+    pthread_mutex_destroy(&render->lock);
+    free(render);
+
+    emu->gpu.render_thread = NULL;
+    emu->gpu.render_pending = 0;
+}
@@ -0,0 +1,257 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "gb/rom.h"
+#include "gb/speed_hacks.h"
+
+/*
+ * Per-game speed hacks, looked up when the ROM is opened.
+ *
+ * The hints in speed_hacks_builtin[] are always used, and are picked out by
+ * the whole title and the header checksum, so they can't land on another
+ * game. More can be read from a text file with --speed-hacks. Games in the
+ * file are picked out the same way as the CGB themes in cgb_themes.c - by the
+ * checksum of the title, and optionally the fourth character of the title
+ * when the checksum isn't enough. Each line of the file gives one hint:
+ *
+ *   <checksum> <title_4> idle <bank>:<addr>
+ *   <checksum> <title_4> ram <addr> <length>
+ *
+ * Numbers are in hex, including 'title_4'. A '-' for 'title_4' matches any
+ * title, and '#' starts a comment. See speed_hacks.txt for the details.
+ *
+ * Timing checks that are safe to skip over aren't a separate kind of hint.
+ * A loop that only polls LY or STAT is an idle loop, and skipping it to the
+ * next GPU event gives the same result as running it.
+ *
+ * An idle hint is only ever acted on if the code at its address is one of
+ * the wait loops gb_speed_hacks_is_wait_loop() knows, so a hint that lands
+ * on the wrong code does nothing.
+ */
+
+struct speed_hack_entry {
+    char title[16];
+    uint8_t header_chksum;
+    struct gb_speed_hack hack;
+};
+
+/* Only add games the hints have been checked with */
+static const struct speed_hack_entry speed_hacks_builtin[] = {
+};
+
+static int speed_hack_add(struct gb_speed_hacks *hacks, const struct gb_speed_hack *hack)
+{
+    if (hacks->count == GB_SPEED_HACKS_MAX)
+        return 1;
+
+    hacks->hacks[hacks->count++] = *hack;
+    return 0;
+}
+
+static void speed_hacks_add_builtin(struct gb_speed_hacks *hacks, struct gb_rom *rom)
+{
+    const struct speed_hack_entry *entry;
+
+    for (entry = speed_hacks_builtin; entry != speed_hacks_builtin + ARRAY_SIZE(speed_hacks_builtin); entry++) {
+        if (memcmp(entry->title, rom->title, sizeof(entry->title)) != 0)
+            continue;
+
+        if (entry->header_chksum != rom->header_checksum)
+            continue;
+
+        speed_hack_add(hacks, &entry->hack);
+    }
+}
+
+static int speed_hack_parse(struct gb_speed_hack *hack, const char *type, const char *args)
+{
+    unsigned int bank, addr, len;
+
+    if (strcmp(type, "idle") == 0) {
+        if (sscanf(args, "%x:%x", &bank, &addr) != 2)
+            return 1;
+
+        hack->type = GB_HACK_IDLE;
+        hack->bank = bank;
+        hack->addr = addr;
+        return 0;
+    }
+
+    if (strcmp(type, "ram") == 0) {
+        if (sscanf(args, "%x %x", &addr, &len) != 2 || addr < 0x8000)
+            return 1;
+
+        hack->type = GB_HACK_RAM_CODE;
+        hack->addr = addr;
+        hack->len = len;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int speed_hacks_read(struct gb_speed_hacks *hacks, const char *filename, struct gb_rom *rom)
+{
+    char line[256];
+    int line_no = 0;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f)
+        return 1;
+
+    while (fgets(line, sizeof(line), f)) {
+        struct gb_speed_hack hack;
+        unsigned int chksum;
+        char title_4[8], type[16], args[64];
+        char *comment;
+
+        line_no++;
+
+        comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        args[0] = '\0';
+        if (sscanf(line, "%x %7s %15s %63[^\n]", &chksum, title_4, type, args) < 3)
+            continue;
+
+        if (chksum != rom->title_chksum)
+            continue;
+
+        if (strcmp(title_4, "-") != 0 && strtoul(title_4, NULL, 16) != (uint8_t)rom->title[3])
+            continue;
+
+        memset(&hack, 0, sizeof(hack));
+
+        if (speed_hack_parse(&hack, type, args)) {
+            printf("%s:%d: Unknown speed hack \"%s %s\"\n", filename, line_no, type, args);
+            continue;
+        }
+
+        if (speed_hack_add(hacks, &hack)) {
+            printf("%s:%d: Too many speed hacks for this game\n", filename, line_no);
+            break;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+/* Fills in the hints for 'rom' from the built in table, and then from
+ * 'filename' if it isn't NULL. Returns the number of hints found, or -1 if
+ * the file can't be read */
+int gb_speed_hacks_load(struct gb_speed_hacks *hacks, const char *filename, struct gb_rom *rom)
+{
+    int i, err = 0;
+
+    memset(hacks, 0, sizeof(*hacks));
+
+    speed_hacks_add_builtin(hacks, rom);
+
+    if (filename)
+        err = speed_hacks_read(hacks, filename, rom);
+
+    for (i = 0; i < hacks->count; i++)
+        if (hacks->hacks[i].type == GB_HACK_IDLE)
+            hacks->idle_addrs[hacks->hacks[i].addr >> 3] |= 1 << (hacks->hacks[i].addr & 7);
+
+    if (err)
+        return -1;
+
+    if (hacks->count)
+        printf("Using %d speed hacks\n", hacks->count);
+
+    return hacks->count;
+}
+
+const struct gb_speed_hack *gb_speed_hacks_find(const struct gb_speed_hacks *hacks, enum gb_speed_hack_type type, uint16_t addr, int bank)
+{
+    int i;
+
+    for (i = 0; i < hacks->count; i++) {
+        const struct gb_speed_hack *hack = hacks->hacks + i;
+
+        if (hack->type != type)
+            continue;
+
+        switch (type) {
+        case GB_HACK_IDLE:
+            if (hack->addr == addr && (addr < 0x4000 || addr >= 0x8000 || hack->bank == bank))
+                return hack;
+            break;
+
+        case GB_HACK_RAM_CODE:
+            if (addr >= hack->addr && addr - hack->addr < hack->len)
+                return hack;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns true if 'code' is a loop that only waits for an interrupt, LY or
+ * STAT, so it is safe to skip to the next GPU or timer event:
+ *
+ *   LDH A, (n) or LD A, (nn)
+ *   AND A, OR A, AND n or CP n
+ *   JR cc, back to the LDH or LD
+ *
+ * The byte read has to be LY, STAT or IF, or be in WRAM or HRAM, where only
+ * an interrupt handler could change it while we wait. 'code' is
+ * GB_SPEED_HACKS_LOOP_LEN bytes.
+ */
+int gb_speed_hacks_is_wait_loop(const uint8_t *code)
+{
+    uint16_t src;
+    int len;
+
+    switch (code[0]) {
+    case 0xF0:
+        src = 0xFF00 | code[1];
+        len = 2;
+        break;
+
+    case 0xFA:
+        src = code[1] | (code[2] << 8);
+        len = 3;
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (src != 0xFF44 && src != 0xFF41 && src != 0xFF0F
+        && !(src >= 0xC000 && src < 0xE000)
+        && !(src >= 0xFF80 && src < 0xFFFF))
+        return 0;
+
+    switch (code[len]) {
+    case 0xA7:
+    case 0xB7:
+        len += 1;
+        break;
+
+    case 0xE6:
+    case 0xFE:
+        len += 2;
+        break;
+
+    default:
+        return 0;
+    }
+
+    if ((code[len] & 0xE7) != 0x20)
+        return 0;
+
+    return (int8_t)code[len + 1] == -(len + 2);
+}
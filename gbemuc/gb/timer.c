@@ -2,6 +2,7 @@
 #include "common.h"
 
 #include <stdint.h>
+#include <limits.h>
 #include <time.h>
 
 #include "debug.h"
@@ -64,6 +65,20 @@ void gb_timer_ticks(struct gb_emu *emu, int cycles)
         gb_timer_tima_ticks(emu, cycles);
 }
 
+/* Returns the number of cycles until TIMA overflows and raises the timer
+ * interrupt. DIV never raises an interrupt, so it doesn't factor in. */
+int gb_timer_event_cycles(struct gb_timer *timer)
+{
+    int divisor;
+
+    if (!timer->clock_active)
+        return INT_MAX;
+
+    divisor = gb_clock_select_divisor[timer->clock_select];
+
+    return ((0x100 - timer->tima) * divisor - timer->tima_count) * 4;
+}
+
 void gb_timer_update_tac(struct gb_emu *emu, uint8_t new_tac)
 {
     emu->timer.tac = new_tac;
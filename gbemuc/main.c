@@ -2,19 +2,152 @@
 #include "common.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 
 #include "arg_parser.h"
 #include "backend_driver.h"
 #include "debug.h"
 #include "gb/rom.h"
+#include "gb/batch.h"
 #include "gb/debugger.h"
+#include "gb/pair_profile.h"
+#include "null_driver.h"
 #include "gb.h"
 
 static const char *gbemuc_version = "gbemuc-" Q(GBEMUC_VERSION);
 
+static const char *screen_format_names[] = {
+    [GB_GPU_FORMAT_ARGB8888] = "argb8888",
+    [GB_GPU_FORMAT_RGB565] = "rgb565",
+    [GB_GPU_FORMAT_INDEX8] = "index8",
+    [GB_GPU_FORMAT_SHADE2] = "shade2",
+};
+
 static struct gb_emu emu;
 
+static void batch_get_input(void *data, int id, int frame, struct gb_keypad *keys)
+{
+    struct gb_null_driver **movies = data;
+
+    gb_null_driver_movie_keys(movies[id], frame, keys);
+}
+
+static uint64_t batch_screen_hash(struct gb_emu *emu)
+{
+    const uint8_t *b = gb_gpu_screen(&emu->gpu);
+    size_t length = (size_t)gb_gpu_format_line_bytes(emu->gpu.format) * GB_SCREEN_HEIGHT;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    /* FNV-1a, the same as the headless --frame-hashes */
+    for (i = 0; i < length; i++) {
+        hash ^= b[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Runs an instance of 'game' for every movie named in the file 'list', one
+ * per line, through a gb_batch. Each instance's movie is played the same way
+ * as with --headless --movie, and "<instance> <hash> <movie>" is written for
+ * the last frame of each one.
+ */
+static int run_batch(const char *prog, const char *game, const char *list, struct gb_config *config,
+                     enum gb_gpu_format format, unsigned int frames, int verify)
+{
+    struct gb_null_driver **movies = NULL;
+    char **names = NULL;
+    struct gb_batch batch;
+    char line[256];
+    int count = 0, size = 0;
+    int i, ret = 1;
+    FILE *f;
+
+    if (!frames) {
+        printf("%s: --batch needs --frames\n", prog);
+        return 1;
+    }
+
+    f = fopen(list, "r");
+    if (!f) {
+        printf("%s: Unable to read batch list '%s'\n", prog, list);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char *name = strtok(line, "\r\n");
+
+        if (!name || !*name || *name == '#')
+            continue;
+
+        if (count == size) {
+            size = size? size * 2: 64;
+            movies = realloc(movies, size * sizeof(*movies));
+            names = realloc(names, size * sizeof(*names));
+        }
+
+        movies[count] = gb_null_driver_new();
+        names[count] = strdup(name);
+        count++;
+
+        if (gb_null_driver_load_movie(movies[count - 1], name)) {
+            printf("%s: Unable to read movie '%s'\n", prog, name);
+            goto cleanup;
+        }
+    }
+
+    fclose(f);
+    f = NULL;
+
+    if (gb_batch_init(&batch, game, config, count)) {
+        printf("%s: Unable to start a batch of %d\n", prog, count);
+        goto cleanup;
+    }
+
+    batch.get_input = batch_get_input;
+    batch.data = movies;
+    gb_batch_set_format(&batch, format);
+
+    while (batch.frame < (int)frames)
+        gb_batch_run_frame(&batch);
+
+    for (i = 0; i < count; i++)
+        printf("%d %016llx %s\n", i, (unsigned long long)batch_screen_hash(gb_batch_emu(&batch, i)), names[i]);
+
+    printf("Batch: Ran %d instances for %u frames in %d lanes\n", count, frames, batch.lane_count);
+
+    ret = 0;
+
+    if (verify) {
+        int bad = gb_batch_verify(&batch);
+
+        printf("Batch: %d of %d instances matched running them alone\n", count - bad, count);
+        if (bad)
+            ret = 1;
+    }
+
+    gb_batch_clear(&batch);
+
+  cleanup:
+    if (f)
+        fclose(f);
+
+    for (i = 0; i < count; i++) {
+        gb_null_driver_destroy(movies[i]);
+        free(names[i]);
+    }
+
+    free(movies);
+    free(names);
+
+    return ret;
+}
+
 static const char *arg_str = "[Flags] [Game]";
 
 #define XARGS \
@@ -22,11 +155,26 @@ static const char *arg_str = "[Flags] [Game]";
     X(cgb_only, "cgb", 0, 'c', "Emulate Color Gameboy (default)") \
     X(cgb_accurate_colors, "cgb-accurate-colors", 0, '\0', "Modifies the color palette to make colors accorate to the CGB display (default)") \
     X(cgb_wrong_colors, "cgb-wrong-colors", 0, '\0', "Treats CGB colors as direct RGB colors.") \
-    X(cpu, "cpu", 1, '\0', "'jit' or 'interpreter' ('interpreter' default)") \
+    X(cpu, "cpu", 1, '\0', "'jit', 'jit-verify' or 'interpreter' ('interpreter' default)") \
+    X(jit_aot, "jit-aot", 0, '\0', "Compile the reachable ROM code before starting the JIT") \
+    X(jit_stats, "jit-stats", 0, '\0', "Display JIT compile statistics on exit") \
+    X(no_idioms, "no-idioms", 0, '\0', "Don't run copy and fill loops in bulk") \
+    X(speed_hacks, "speed-hacks", 1, '\0', "Read more speed hacks from a file, on top of the built in ones") \
+    X(frameskip, "frameskip", 1, '\0', "Skip drawing N frames after each one displayed, or 'auto' to skip only when running slow") \
+    X(render_thread, "render-thread", 0, '\0', "Draw the screen on a separate thread (Requires CONFIG_RENDER_THREAD)") \
+    X(screen_format, "screen-format", 1, '\0', "Draw the screen as 'argb8888' (default), 'rgb565', 'index8' or 'shade2'") \
+    X(pair_profile, "pair-profile", 0, '\0', "Display the most common pairs of instructions on exit") \
+    X(headless, "headless", 0, '\0', "Run without a display or audio") \
+    X(movie, "movie", 1, '\0', "With --headless, read the keys from a movie file") \
+    X(frame_hashes, "frame-hashes", 1, '\0', "With --headless, write the hash of every frame to a file ('-' for stdout)") \
+    X(frames, "frames", 1, '\0', "With --headless, stop after running this many frames") \
+    X(batch, "batch", 1, '\0', "Run one instance per movie listed in a file in lockstep, for --frames frames, and write the hash of each one's last frame") \
+    X(batch_verify, "batch-verify", 0, '\0', "With --batch, check every instance against running it alone") \
     X(help, "help", 0, 'h', "Display help") \
     X(version, "version", 0, 'v', "Display version information") \
     X(sav, "sav", 1, 's', "Specify a sav file to load") \
     X(info, "info", 0, 'i', "Dump game information and exist") \
+    X(debugger, "debugger", 0, 'd', "Start in the debugger") \
     X(last, NULL, 0, '\0', NULL)
 
 enum arg_index {
@@ -51,6 +199,22 @@ int main(int argc, char **argv)
     const char *game = NULL;
     int cpu_type = GB_CPU_INTERPRETER;
     int info_only = 0;
+    int use_debugger = 0;
+    int use_pair_profile = 0;
+    const char *movie = NULL;
+    const char *frame_hashes = NULL;
+    const char *batch_list = NULL;
+    int batch_verify = 0;
+    unsigned int frames = 0;
+    FILE *hash_file = NULL;
+    enum gb_gpu_format screen_format = GB_GPU_FORMAT_ARGB8888;
+    gb_backend_driver *driver = NULL;
+    struct gb_null_driver *null_driver = NULL;
+#ifdef GBEMUC_BACKEND_NULL
+    int headless = 1;
+#else
+    int headless = 0;
+#endif
 
     DEBUG_INIT();
 
@@ -90,10 +254,12 @@ int main(int argc, char **argv)
             {
                 char *s, *str = strdup(argarg);
                 for (s = str; *s; s++)
-                    *s = tolower(*s);
+                    *s = tolower((unsigned char)*s);
 
                 if (strcmp(str, "jit") == 0) {
                     cpu_type = GB_CPU_JIT;
+                } else if (strcmp(str, "jit-verify") == 0) {
+                    cpu_type = GB_CPU_JIT_VERIFY;
                 } else if (strcmp(str, "interpreter") == 0) {
                     cpu_type = GB_CPU_INTERPRETER;
                 } else {
@@ -105,15 +271,99 @@ int main(int argc, char **argv)
             }
             break;
 
+        case ARG_jit_aot:
+            emu.config.jit_aot = 1;
+            break;
+
+        case ARG_jit_stats:
+            emu.config.jit_stats = 1;
+            break;
+
+        case ARG_no_idioms:
+            emu.config.no_idioms = 1;
+            break;
+
+        case ARG_speed_hacks:
+            emu.config.speed_hacks_file = argarg;
+            break;
+
+        case ARG_frameskip:
+            if (strcasecmp(argarg, "auto") == 0) {
+                emu.config.frameskip = GB_FRAMESKIP_AUTO;
+            } else {
+                char *end;
+                long frames = strtol(argarg, &end, 0);
+
+                if (*end || end == argarg || frames < 0) {
+                    printf("%s: Invalid frame skip '%s'\n", argv[0], argarg);
+                    return 0;
+                }
+
+                emu.config.frameskip = frames;
+            }
+            break;
+
+        case ARG_render_thread:
+            emu.config.render_thread = 1;
+            break;
+
+        case ARG_screen_format: {
+            int i;
+
+            for (i = 0; i < (int)ARRAY_SIZE(screen_format_names); i++)
+                if (strcasecmp(argarg, screen_format_names[i]) == 0)
+                    break;
+
+            if (i == (int)ARRAY_SIZE(screen_format_names)) {
+                printf("%s: Unknown screen format '%s'\n", argv[0], argarg);
+                return 0;
+            }
+
+            screen_format = i;
+            break;
+        }
+
+        case ARG_pair_profile:
+            use_pair_profile = 1;
+            break;
+
         case ARG_sav:
             printf("Using save file: %s\n", argarg);
             emu.rom.sav_filename = argarg;
             break;
 
+        case ARG_headless:
+            headless = 1;
+            break;
+
+        case ARG_movie:
+            movie = argarg;
+            break;
+
+        case ARG_frame_hashes:
+            frame_hashes = argarg;
+            break;
+
+        case ARG_frames:
+            frames = strtoul(argarg, NULL, 0);
+            break;
+
+        case ARG_batch:
+            batch_list = argarg;
+            break;
+
+        case ARG_batch_verify:
+            batch_verify = 1;
+            break;
+
         case ARG_info:
             info_only = 1;
             break;
 
+        case ARG_debugger:
+            use_debugger = 1;
+            break;
+
         case ARG_EXTRA:
             if (!game)
                 game = argarg;
@@ -140,16 +390,58 @@ int main(int argc, char **argv)
     if (info_only)
         return 0;
 
-    gb_backend_driver *driver = gb_backend_driver_new();
+    if (batch_list) {
+        int err = run_batch(argv[0], game, batch_list, &emu.config, screen_format, frames, batch_verify);
 
-    if (!driver) {
-        printf("Unable to initialize gbemuc backend driver!\n");
-        return 1;
+        /* This emu only read the header, it never ran - don't write its
+         * untouched cartridge RAM over the .sav */
+        emu.rom.sav_filename = NULL;
+        gb_emu_clear(&emu);
+        DEBUG_CLOSE();
+        return err;
     }
 
-    disp = gb_backend_get_gpu_display(driver);
-    sound = gb_backend_get_apu_sound(driver);
+    if (headless) {
+        null_driver = gb_null_driver_new();
+
+        if (movie && gb_null_driver_load_movie(null_driver, movie)) {
+            printf("%s: Unable to read movie '%s'\n", argv[0], movie);
+            return 1;
+        }
+
+        if (frame_hashes) {
+            hash_file = strcmp(frame_hashes, "-") == 0? stdout: fopen(frame_hashes, "w");
+            if (!hash_file) {
+                printf("%s: Unable to open '%s'\n", argv[0], frame_hashes);
+                return 1;
+            }
+
+            gb_null_driver_set_hash_file(null_driver, hash_file);
+        }
+
+        gb_null_driver_set_frame_limit(null_driver, frames);
+
+        disp = gb_null_driver_get_gb_gpu_display(null_driver);
+        sound = NULL;
+    } else {
+        driver = gb_backend_driver_new();
+
+        if (!driver) {
+            printf("Unable to initialize gbemuc backend driver!\n");
+            return 1;
+        }
 
+        disp = gb_backend_get_gpu_display(driver);
+        sound = gb_backend_get_apu_sound(driver);
+
+        if (!gb_backend_supports_format(screen_format)) {
+            printf("%s: The display can't show the screen as '%s'\n", argv[0], screen_format_names[screen_format]);
+            gb_backend_driver_destroy(driver);
+            return 1;
+        }
+    }
+
+    disp->format = screen_format;
     gb_emu_set_display(&emu, disp);
 
     if (sound)
@@ -157,11 +449,28 @@ int main(int argc, char **argv)
 
     gb_emu_reset(&emu);
 
-    gb_run(&emu, cpu_type);
-    // gb_debugger_run(&emu);
+    if (use_debugger) {
+        gb_debugger_run(&emu, cpu_type);
+    } else if (use_pair_profile) {
+        struct gb_pair_profile *profile = gb_pair_profile_start(&emu);
+
+        gb_run(&emu, cpu_type);
+
+        gb_pair_profile_print(profile, stdout);
+        gb_pair_profile_stop(&emu, profile);
+    } else {
+        gb_run(&emu, cpu_type);
+    }
 
     gb_emu_clear(&emu);
-    gb_backend_driver_destroy(driver);
+
+    if (null_driver)
+        gb_null_driver_destroy(null_driver);
+    else
+        gb_backend_driver_destroy(driver);
+
+    if (hash_file && hash_file != stdout)
+        fclose(hash_file);
 
     DEBUG_CLOSE();
 
@@ -0,0 +1,225 @@
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gb.h"
+#include "gb/gpu.h"
+#include "null_driver.h"
+
+/*
+ * The movie is a text file giving the keys held down from a frame onward:
+ *
+ *   <frame> <keys...>
+ *
+ * Frames are counted from zero, and the lines have to be in order. The keys
+ * are any of 'a', 'b', 'up', 'down', 'left', 'right', 'start' and 'select',
+ * or '-' for none. '#' starts a comment.
+ *
+ * The keys are read at the end of every frame, so the same movie always
+ * gives the same run.
+ */
+
+struct gb_null_movie_entry {
+    unsigned int frame;
+    struct gb_keypad keys;
+};
+
+struct gb_null_driver {
+    struct gb_gpu_display disp;
+
+    struct gb_null_movie_entry *movie;
+    int movie_length;
+    int movie_pos;
+
+    FILE *hash_file;
+    uint64_t hash;
+    int has_hash;
+    unsigned int frame_limit;
+
+    /* The frame the display is currently showing */
+    unsigned int frame;
+};
+
+static const struct gb_keypad null_keys_released = {
+    .key_a = 1, .key_b = 1,
+    .key_up = 1, .key_down = 1, .key_left = 1, .key_right = 1,
+    .key_start = 1, .key_select = 1,
+};
+
+static void gb_null_display(struct gb_gpu_display *disp, void *buf, const uint32_t *dirty_lines)
+{
+    struct gb_null_driver *driver = container_of(disp, struct gb_null_driver, disp);
+    const uint8_t *b = buf;
+    size_t length = (size_t)gb_gpu_format_line_bytes(disp->format) * GB_SCREEN_HEIGHT;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    int y;
+
+    if (!driver->hash_file)
+        return ;
+
+    /* The hash only changes if some line did */
+    for (y = 0; y < GB_SCREEN_HEIGHT; y++)
+        if (gb_gpu_line_is_dirty(dirty_lines, y))
+            break;
+
+    if (y < GB_SCREEN_HEIGHT || !driver->has_hash) {
+        /* FNV-1a */
+        for (i = 0; i < length; i++) {
+            hash ^= b[i];
+            hash *= 1099511628211ULL;
+        }
+
+        driver->hash = hash;
+        driver->has_hash = 1;
+    }
+
+    fprintf(driver->hash_file, "%u %016llx\n", driver->frame, (unsigned long long)driver->hash);
+}
+
+void gb_null_driver_movie_keys(struct gb_null_driver *driver, unsigned int frame, struct gb_keypad *keys)
+{
+    /* Start over if an earlier frame is asked for, when a movie is played
+     * again from the beginning */
+    if (driver->movie_pos && driver->movie[driver->movie_pos - 1].frame > frame)
+        driver->movie_pos = 0;
+
+    while (driver->movie_pos < driver->movie_length
+           && driver->movie[driver->movie_pos].frame <= frame)
+        driver->movie_pos++;
+
+    if (driver->movie_pos)
+        *keys = driver->movie[driver->movie_pos - 1].keys;
+    else
+        *keys = null_keys_released;
+}
+
+static void gb_null_get_keystate(struct gb_emu *emu, struct gb_keypad *keys)
+{
+    struct gb_null_driver *driver = container_of(emu->gpu.display, struct gb_null_driver, disp);
+
+    driver->frame = emu->gpu.frame_count;
+
+    gb_null_driver_movie_keys(driver, driver->frame, keys);
+
+    if (driver->frame_limit && driver->frame >= driver->frame_limit)
+        emu->stop_emu = 1;
+}
+
+static int null_movie_key(struct gb_keypad *keys, const char *key)
+{
+    if (strcmp(key, "-") == 0)
+        return 0;
+    else if (strcmp(key, "a") == 0)
+        keys->key_a = 0;
+    else if (strcmp(key, "b") == 0)
+        keys->key_b = 0;
+    else if (strcmp(key, "up") == 0)
+        keys->key_up = 0;
+    else if (strcmp(key, "down") == 0)
+        keys->key_down = 0;
+    else if (strcmp(key, "left") == 0)
+        keys->key_left = 0;
+    else if (strcmp(key, "right") == 0)
+        keys->key_right = 0;
+    else if (strcmp(key, "start") == 0)
+        keys->key_start = 0;
+    else if (strcmp(key, "select") == 0)
+        keys->key_select = 0;
+    else
+        return 1;
+
+    return 0;
+}
+
+int gb_null_driver_load_movie(struct gb_null_driver *driver, const char *filename)
+{
+    char line[256];
+    int line_no = 0;
+    int size = 0;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (!f)
+        return 1;
+
+    while (fgets(line, sizeof(line), f)) {
+        struct gb_null_movie_entry *entry;
+        char *comment, *key, *end;
+        unsigned long frame;
+
+        line_no++;
+
+        comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        key = strtok(line, " \t\r\n");
+        if (!key)
+            continue;
+
+        frame = strtoul(key, &end, 10);
+        if (*end || (driver->movie_length && frame < driver->movie[driver->movie_length - 1].frame)) {
+            printf("%s:%d: Invalid frame \"%s\"\n", filename, line_no, key);
+            continue;
+        }
+
+        if (driver->movie_length == size) {
+            size = size? size * 2: 64;
+            driver->movie = realloc(driver->movie, size * sizeof(*driver->movie));
+        }
+
+        entry = driver->movie + driver->movie_length++;
+        entry->frame = frame;
+        entry->keys = null_keys_released;
+
+        while ((key = strtok(NULL, " \t\r\n")))
+            if (null_movie_key(&entry->keys, key))
+                printf("%s:%d: Unknown key \"%s\"\n", filename, line_no, key);
+    }
+
+    fclose(f);
+
+    driver->movie_pos = 0;
+    return 0;
+}
+
+void gb_null_driver_set_hash_file(struct gb_null_driver *driver, FILE *f)
+{
+    driver->hash_file = f;
+}
+
+void gb_null_driver_set_frame_limit(struct gb_null_driver *driver, unsigned int frames)
+{
+    driver->frame_limit = frames;
+}
+
+struct gb_null_driver *gb_null_driver_new(void)
+{
+    struct gb_null_driver *driver = malloc(sizeof(*driver));
+
+    memset(driver, 0, sizeof(*driver));
+
+    driver->disp.disp_buf = gb_null_display;
+    driver->disp.get_keystate = gb_null_get_keystate;
+
+    return driver;
+}
+
+void gb_null_driver_destroy(struct gb_null_driver *driver)
+{
+    if (driver->hash_file)
+        fflush(driver->hash_file);
+
+    free(driver->movie);
+    free(driver);
+}
+
+struct gb_gpu_display *gb_null_driver_get_gb_gpu_display(struct gb_null_driver *driver)
+{
+    return &driver->disp;
+}
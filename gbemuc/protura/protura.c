@@ -69,7 +69,7 @@ static uint64_t timeval_to_us(const struct timeval *timeval)
     return (uint64_t)timeval->tv_sec * 1000000 + timeval->tv_usec;
 }
 
-static void gb_protura_display(struct gb_gpu_display *disp, union gb_gpu_color_u *buff)
+static void gb_protura_display(struct gb_gpu_display *disp, void *buff, const uint32_t *dirty_lines)
 {
     struct gb_display_protura *protura = container_of(disp, struct gb_display_protura, gb_disp);
     uint32_t *fb = protura->framebuffer.framebuffer;
@@ -93,6 +93,11 @@ static void gb_protura_display(struct gb_gpu_display *disp, union gb_gpu_color_u
      * Since we write 4 bytes at a time, and a cache line is probably 32 bytes,
      * that a potential 8x speed up for linear writes vs. non-linear writes. */
     for (y = 0; y < GB_SCREEN_HEIGHT; y++, buf_offset += GB_SCREEN_WIDTH) {
+        if (!gb_gpu_line_is_dirty(dirty_lines, y)) {
+            fb_y_start += disp_width * protura->scale;
+            continue;
+        }
+
         for (y1 = 0; y1 < protura->scale; y1++, fb_y_start += disp_width) {
 
             uint32_t *fb_x_start = fb_y_start;
@@ -210,6 +215,7 @@ static void gb_protura_get_keystate(struct gb_emu *emu, struct gb_keypad *keys)
                 if (event_buffer[i].value == KERN_EVENT_KEY_RELEASE) {
                     protura->cur_palette = (protura->cur_palette + 1) % GB_PALETTES;
                     emu->gpu.display->dmg_theme = gb_palettes[protura->cur_palette];
+                    gb_gpu_palettes_flush(&emu->gpu);
                 }
                 break;
             }
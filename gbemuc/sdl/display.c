@@ -28,23 +28,68 @@ struct gb_dmg_theme gb_palettes[] = {
 
 #define GB_PALETTES (sizeof(gb_palettes)/sizeof(*gb_palettes))
 
-static void gb_sdl_display(struct gb_gpu_display *disp, union gb_gpu_color_u *buff)
+/* The texture is made again whenever the display's format changes - only
+ * ARGB8888 and RGB565 can be shown */
+static void gb_sdl_create_texture(struct gb_display_sdl *sdl)
+{
+    uint32_t format = SDL_PIXELFORMAT_ARGB8888;
+
+    if (sdl->gb_disp.format == GB_GPU_FORMAT_RGB565)
+        format = SDL_PIXELFORMAT_RGB565;
+
+    if (sdl->texture)
+        SDL_DestroyTexture(sdl->texture);
+
+    sdl->texture = SDL_CreateTexture(sdl->dest_rend, format, SDL_TEXTUREACCESS_STREAMING, GB_SCREEN_WIDTH, GB_SCREEN_HEIGHT);
+    sdl->texture_format = sdl->gb_disp.format;
+}
+
+/* Uploads each run of dirty lines, returns the number of lines uploaded */
+static int gb_sdl_update_texture(struct gb_display_sdl *sdl, uint8_t *buff, const uint32_t *dirty_lines)
+{
+    int pitch = gb_gpu_format_line_bytes(sdl->gb_disp.format);
+    int y = 0, count = 0;
+
+    while (y < GB_SCREEN_HEIGHT) {
+        int start;
+
+        if (!gb_gpu_line_is_dirty(dirty_lines, y)) {
+            y++;
+            continue;
+        }
+
+        for (start = y; y < GB_SCREEN_HEIGHT && gb_gpu_line_is_dirty(dirty_lines, y); y++)
+            ;
+
+        SDL_UpdateTexture(sdl->texture, &(struct SDL_Rect) { .y = start, .w = GB_SCREEN_WIDTH, .h = y - start },
+                          buff + start * pitch, pitch);
+        count += y - start;
+    }
+
+    return count;
+}
+
+static void gb_sdl_display(struct gb_gpu_display *disp, void *buff, const uint32_t *dirty_lines)
 {
     struct gb_display_sdl *sdl = container_of(disp, struct gb_display_sdl, gb_disp);
-    void *pixels;
-    int pitch = GB_SCREEN_WIDTH * sizeof(uint32_t);
     int height, width;
 
-    SDL_GetWindowSize(sdl->win, &width, &height);
-
-    SDL_LockTexture(sdl->texture, NULL, &pixels, &pitch);
+    if (sdl->texture_format != disp->format) {
+        gb_sdl_create_texture(sdl);
+        dirty_lines = NULL;
+    }
 
-    memcpy(pixels, buff, GB_SCREEN_HEIGHT * GB_SCREEN_WIDTH * sizeof(uint32_t));
+    SDL_GetWindowSize(sdl->win, &width, &height);
 
-    SDL_UnlockTexture(sdl->texture);
+    /* Nothing needs presenting if the screen and window are the same as last
+     * time, which is common on menus and text boxes */
+    if (gb_sdl_update_texture(sdl, buff, dirty_lines) || width != sdl->last_width || height != sdl->last_height) {
+        SDL_RenderCopy(sdl->dest_rend, sdl->texture, NULL, &(struct SDL_Rect) { .w = width, .h = height});
+        SDL_RenderPresent(sdl->dest_rend);
 
-    SDL_RenderCopy(sdl->dest_rend, sdl->texture, NULL, &(struct SDL_Rect) { .w = width, .h = height});
-    SDL_RenderPresent(sdl->dest_rend);
+        sdl->last_width = width;
+        sdl->last_height = height;
+    }
 
     if (sdl->last_tick == 0) {
         sdl->last_tick = SDL_GetTicks();
@@ -102,6 +147,7 @@ static void gb_sdl_get_keystate(struct gb_emu *emu, struct gb_keypad *keys)
     if (keystate[SDL_SCANCODE_P] && !sdl->p_pressed) {
         sdl->cur_palette = (sdl->cur_palette + 1) % GB_PALETTES;
         emu->gpu.display->dmg_theme = gb_palettes[sdl->cur_palette];
+        gb_gpu_palettes_flush(&emu->gpu);
 
         sdl->p_pressed = 1;
     } else if (!keystate[SDL_SCANCODE_P]) {
@@ -147,7 +193,7 @@ void gb_display_sdl_init(struct gb_display_sdl *disp, SDL_Window *window)
     disp->win = window;
     disp->dest_rend = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED); // | SDL_RENDERER_PRESENTVSYNC);
 
-    disp->texture = SDL_CreateTexture(disp->dest_rend, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, GB_SCREEN_WIDTH, GB_SCREEN_HEIGHT);
+    gb_sdl_create_texture(disp);
 
     disp->last_tick = 0;
     disp->show_fps = 0;
@@ -12,11 +12,13 @@
 struct gb_display_sdl {
     struct gb_gpu_display gb_disp;
     SDL_Texture *texture;
+    enum gb_gpu_format texture_format;
 
     SDL_Window *win;
     SDL_Renderer *dest_rend;
 
     unsigned int last_tick;
+    int last_width, last_height;
     unsigned int show_fps;
     int fps_count;
     unsigned int fps_start;
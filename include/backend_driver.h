@@ -12,6 +12,8 @@ typedef struct gb_sdl_driver gb_backend_driver;
 #define gb_backend_get_gpu_display(driver) gb_sdl_driver_get_gb_gpu_display((driver))
 #define gb_backend_get_apu_sound(driver)   gb_sdl_driver_get_gb_apu_sound((driver))
 
+#define gb_backend_supports_format(format) ((format) == GB_GPU_FORMAT_ARGB8888 || (format) == GB_GPU_FORMAT_RGB565)
+
 #elif defined(GBEMUC_BACKEND_PROTURA)
 
 #include "protura_driver.h"
@@ -24,6 +26,22 @@ typedef struct gb_protura_driver gb_backend_driver;
 #define gb_backend_get_gpu_display(driver) gb_protura_driver_get_gb_gpu_display((driver))
 #define gb_backend_get_apu_sound(driver) (NULL)
 
+#define gb_backend_supports_format(format) ((format) == GB_GPU_FORMAT_ARGB8888)
+
+#elif defined(GBEMUC_BACKEND_NULL)
+
+#include "null_driver.h"
+
+typedef struct gb_null_driver gb_backend_driver;
+
+#define gb_backend_driver_new() gb_null_driver_new()
+#define gb_backend_driver_destroy(driver) gb_null_driver_destroy((driver))
+
+#define gb_backend_get_gpu_display(driver) gb_null_driver_get_gb_gpu_display((driver))
+#define gb_backend_get_apu_sound(driver) (NULL)
+
+#define gb_backend_supports_format(format) (1)
+
 #else
 #error "No gbemuc backend setting!"
 #endif
@@ -8,7 +8,9 @@
 #include "gb/gpu.h"
 #include "gb/sound.h"
 #include "gb/timer.h"
+#include "gb/io.h"
 #include "gb/rom.h"
+#include "gb/speed_hacks.h"
 
 #define GB_HZ 4194304
 /* #define GB_HZ 256 */
@@ -26,11 +28,34 @@ enum gb_emu_type {
 enum gb_cpu_type {
     GB_CPU_INTERPRETER,
     GB_CPU_JIT,
+    GB_CPU_JIT_VERIFY,
 };
 
+/* Skip frames only when running behind real time */
+#define GB_FRAMESKIP_AUTO -1
+
 struct gb_config {
     enum gb_emu_type type;
     int cgb_real_colors;
+
+    /* Compile the ROM ahead of time when using the JIT */
+    int jit_aot;
+
+    /* Report how much time the JIT spent compiling when it exits */
+    int jit_stats;
+
+    /* Run copy and fill loops one instruction at a time, rather then in bulk */
+    int no_idioms;
+
+    /* A file to read more speed hacks from, on top of the built in ones */
+    const char *speed_hacks_file;
+
+    /* How many frames to skip after each one that is displayed, or
+     * GB_FRAMESKIP_AUTO */
+    int frameskip;
+
+    /* Draw the screen on its own thread, if built with CONFIG_RENDER_THREAD */
+    int render_thread;
 };
 
 struct gb_emu {
@@ -39,10 +64,12 @@ struct gb_emu {
     struct gb_mmu mmu;
     struct gb_gpu gpu;
     struct gb_timer timer;
+    struct gb_io io;
 
     struct gb_sound sound;
 
     struct gb_rom rom;
+    struct gb_speed_hacks hacks;
 
     unsigned int hook_flag;
     unsigned int stop_emu;
@@ -54,6 +81,10 @@ struct gb_emu {
 
     int breakpoint_count;
     uint16_t *breakpoints;
+
+    /* Incremented whenever the breakpoints change, so compiled code that
+     * depends on them can be thrown away */
+    unsigned int breakpoint_gen;
 };
 
 #define gb_emu_is_cgb(emu) ((emu)->gb_type == GB_EMU_CGB)
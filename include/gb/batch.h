@@ -0,0 +1,70 @@
+#ifndef INCLUDE_GB_BATCH_H
+#define INCLUDE_GB_BATCH_H
+
+#include "gb.h"
+#include "gb/gpu.h"
+
+/* Fills in 'keys' with the keys instance 'id' reads at the end of 'frame',
+ * which are held down from then on. Frames are counted like gpu.frame_count,
+ * so the first one is 1. */
+typedef void (*gb_batch_input_f) (void *data, int id, int frame, struct gb_keypad *keys);
+
+/* One gb_emu, run on behalf of every instance whose input has matched so far */
+struct gb_batch_lane {
+    struct gb_emu emu;
+    struct gb_gpu_display display;
+
+    struct gb_keypad keys;
+    int has_keys;
+
+    /* The lane this one was split from, or -1 */
+    int parent;
+};
+
+/*
+ * A batch of instances of the same ROM, which only differ in their input, run
+ * a frame at a time in lockstep.
+ *
+ * The emulator is deterministic, so instances that have seen the same input
+ * are in the same state. They share a lane, which is only run once per frame.
+ * When the input of some instances in a lane stops matching, the lane is
+ * split by copying its gb_emu, and they carry on separately from there.
+ *
+ * This only saves work for as long as instances share their input. Once
+ * every instance is in its own lane, a batch of N costs the same as N
+ * separate runs, plus the copies made when splitting.
+ */
+struct gb_batch {
+    int count;
+    int frame;
+
+    const char *filename;
+    struct gb_config config;
+
+    int lane_count;
+    struct gb_batch_lane **lanes;
+
+    /* Per instance - The lane it runs in, and its input for this frame */
+    int *lane_of;
+    struct gb_keypad *keys;
+
+    gb_batch_input_f get_input;
+    void *data;
+};
+
+int gb_batch_init(struct gb_batch *batch, const char *filename, const struct gb_config *config, int count);
+void gb_batch_clear(struct gb_batch *batch);
+
+void gb_batch_run_frame(struct gb_batch *batch);
+void gb_batch_set_format(struct gb_batch *batch, enum gb_gpu_format format);
+int gb_batch_verify(struct gb_batch *batch);
+
+/* The gb_emu that instance 'id' is currently running in. It is shared with
+ * the other instances in its lane, and so should not be modified. Its screen
+ * is gb_gpu_screen(). */
+static inline struct gb_emu *gb_batch_emu(struct gb_batch *batch, int id)
+{
+    return &batch->lanes[batch->lane_of[id]]->emu;
+}
+
+#endif
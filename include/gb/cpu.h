@@ -83,6 +83,9 @@ struct gb_cpu {
 
     int m, t;
 
+    /* Total number of cycles the clock has been advanced by */
+    uint64_t cycles;
+
     /* Note, the JIT relies on these flags being uint8_t */
     uint8_t halted;
     uint8_t stopped;
@@ -1,8 +1,8 @@
 #ifndef INCLUDE_GB_DEBUGGER_H
 #define INCLUDE_GB_DEBUGGER_H
 
-struct gb_emu;
+#include "gb.h"
 
-void gb_debugger_run(struct gb_emu *emu);
+void gb_debugger_run(struct gb_emu *emu, enum gb_cpu_type cpu_type);
 
 #endif
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_GB_FASTMEM_H
+#define INCLUDE_GB_FASTMEM_H
+
+#include <stdint.h>
+
+struct gb_emu;
+
+#define GB_FASTMEM_SIZE      0x10000
+#define GB_FASTMEM_PAGE_SIZE 0x1000
+#define GB_FASTMEM_PAGES     (0x8000 / GB_FASTMEM_PAGE_SIZE)
+
+/*
+ * The guest's ROM, mapped into a 64KB host region so that a guest address is
+ * just an offset from 'base'. The ROM is kept in a memfd, and the pages in
+ * 0x0000 to 0x7FFF are mmap()'d from it, so a bank switch only remaps the
+ * pages that changed.
+ *
+ * Everything else is left PROT_NONE. A page can only be read directly if its
+ * bit in 'readable' is set - anything else goes through the MMU as normal.
+ */
+struct gb_fastmem {
+    uint8_t *base;
+    int rom_fd;
+
+    /* The ROM offset mapped at each page, or -1 */
+    long offsets[GB_FASTMEM_PAGES];
+    uint16_t readable;
+
+    /* Set when the MBC was written, the mapping is checked again on the next
+     * read */
+    int stale;
+};
+
+int gb_fastmem_init(struct gb_emu *emu);
+void gb_fastmem_clear(struct gb_fastmem *fastmem);
+void gb_fastmem_sync(struct gb_emu *emu);
+
+static inline int gb_fastmem_readable(struct gb_fastmem *fastmem, uint16_t addr)
+{
+    return (fastmem->readable >> (addr >> 12)) & 1;
+}
+
+static inline void gb_fastmem_invalidate(struct gb_fastmem *fastmem)
+{
+    fastmem->readable = 0;
+    fastmem->stale = 1;
+}
+
+#endif
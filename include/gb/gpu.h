@@ -48,6 +48,10 @@ enum {
 
 #define GB_GPU_VBLANK_LENGTH 10
 
+/* Length of a full frame, which is also counted while the display is off */
+#define GB_GPU_CLOCK_FRAME (GB_GPU_CLOCK_VBLANK * GB_GPU_VBLANK_LENGTH \
+                            + (GB_GPU_CLOCK_HBLANK + GB_GPU_CLOCK_OAM + GB_GPU_CLOCK_VRAM) * GB_SCREEN_HEIGHT)
+
 struct gb_gpu_color {
     uint8_t a, r, b, g;
 };
@@ -97,11 +101,64 @@ struct gb_keypad {
     int key_select;
 };
 
+#define GB_GPU_DIRTY_WORDS ((GB_SCREEN_HEIGHT + 31) / 32)
+
+/* The formats the screen can be drawn in, see 'format' in gb_gpu_display */
+enum gb_gpu_format {
+    GB_GPU_FORMAT_ARGB8888, /* A union gb_gpu_color_u per pixel */
+    GB_GPU_FORMAT_RGB565,   /* A uint16_t per pixel */
+    GB_GPU_FORMAT_INDEX8,   /* A byte per pixel, see GB_GPU_INDEX() and
+                             * 'palette' in gb_gpu_display */
+    GB_GPU_FORMAT_SHADE2,   /* Two bits per pixel, four to a byte with the
+                             * left-most pixel lowest - 0 is the lightest */
+};
+
+/* The INDEX8 value of color 'c' of palette 'pal' - BG palettes 0 to 7,
+ * followed by OBJ palettes 0 to 7. The DMG only uses BG palette 0 and OBJ
+ * palettes 0 and 1. GB_GPU_INDEX_BLANK is shown while the screen is off. */
+#define GB_GPU_INDEX(pal, c) ((pal) * 4 + (c))
+#define GB_GPU_INDEX_BLANK   GB_GPU_INDEX(16, 0)
+#define GB_GPU_INDEXES       (GB_GPU_INDEX_BLANK + 1)
+
+/* The size of a line of the screen in 'format' - every line follows right
+ * after the one before it */
+static inline int gb_gpu_format_line_bytes(enum gb_gpu_format format)
+{
+    switch (format) {
+    case GB_GPU_FORMAT_RGB565:
+        return GB_SCREEN_WIDTH * 2;
+
+    case GB_GPU_FORMAT_INDEX8:
+        return GB_SCREEN_WIDTH;
+
+    case GB_GPU_FORMAT_SHADE2:
+        return GB_SCREEN_WIDTH / 4;
+
+    case GB_GPU_FORMAT_ARGB8888:
+    default:
+        return GB_SCREEN_WIDTH * 4;
+    }
+}
+
 struct gb_gpu_display {
-    void (*disp_buf) (struct gb_gpu_display *, union gb_gpu_color_u *buf);
+    /* 'buf' holds the screen in 'format'. 'dirty_lines' has a bit set for
+     * each line that changed since the last call, the rest of 'buf' is the
+     * same as before. NULL means every line has to be displayed. */
+    void (*disp_buf) (struct gb_gpu_display *, void *buf, const uint32_t *dirty_lines);
     void (*get_keystate) (struct gb_emu *, struct gb_keypad *keys);
 
     struct gb_dmg_theme dmg_theme;
+
+    /* The format the screen is drawn in for this display, read by
+     * gb_emu_set_display() */
+    enum gb_gpu_format format;
+
+    /* Set by gb_emu_set_display() - the color of every GB_GPU_INDEX() value,
+     * for INDEX8 displays to look the screen up in. Every line is marked
+     * dirty when the colors change. Only the colors as of the end of the
+     * frame are given, so palette changes part way through a frame show up
+     * on the whole screen. */
+    const union gb_gpu_color_u *palette;
 };
 
 extern union gb_gpu_color_u gb_colors[][4];
@@ -150,8 +207,31 @@ enum gb_gpu_mode {
 #define GB_IO_CGB_SPRITE_PAL_INDEX 0xFF6A
 #define GB_IO_CGB_SPRITE_PAL_DATA  0xFF6B
 
+#define GB_GPU_TILES 384
+#define GB_GPU_LINE_SPRITES 10
+
+/* The registers a line is drawn with, as they were when it was reached */
+struct gb_gpu_line_regs {
+    uint8_t cur_line;
+    uint8_t ctl;
+    uint8_t scroll_x, scroll_y;
+    uint8_t window_x, window_y;
+};
+
+struct gb_render_thread;
+
 struct gb_gpu {
+    /* Lines are drawn into 'screen_index' as GB_GPU_INDEX() values, and then
+     * looked up in the palette tables into 'screenbuf' in 'format'. INDEX8
+     * is displayed straight from 'screen_index'. See gb_gpu_screen(). */
+    enum gb_gpu_format format;
     union gb_gpu_color_u screenbuf[GB_SCREEN_HEIGHT * GB_SCREEN_WIDTH];
+    uint8_t screen_index[GB_SCREEN_HEIGHT * GB_SCREEN_WIDTH];
+
+    /* A hash of each line as it was last drawn. A line whose hash changes is
+     * marked in 'dirty_lines' until the screen is next displayed. */
+    uint64_t line_hash[GB_SCREEN_HEIGHT];
+    uint32_t dirty_lines[GB_GPU_DIRTY_WORDS];
 
     int clock;
 
@@ -171,36 +251,153 @@ struct gb_gpu {
 
     int frame_is_done;
 
+    /* Frames finished since the GPU was reset */
+    unsigned int frame_count;
+
+    /* Set while the current frame is skipped - the timing and interrupts are
+     * the same, but no lines are drawn and the frame isn't displayed. Decided
+     * at the end of the frame before it, see 'frameskip' in gb_config. */
+    int skip_frame;
+    int frames_skipped;
+
+    /* Used by GB_FRAMESKIP_AUTO - when the next frame should be finished by
+     * to keep up with real time, in nanoseconds */
+    uint64_t frame_due_ns;
+
     int cgb_vram_bank_no;
     union {
         uint8_t mem[8 * 0x0400];
         struct {
-            uint8_t sprites[384][16]; /* 256 + 128 sprites */
+            uint8_t sprites[GB_GPU_TILES][16]; /* 256 + 128 sprites */
             uint8_t bkgd[2][0x0400]; /* 2K of background info */
         } seg;
     } vram[2];
 
+    /* Every row of every tile, decoded into one color number per byte with
+     * the left-most pixel lowest, both as-is and X flipped. A tile is only
+     * decoded again after a write to it sets its bit in 'tile_dirty'. */
+    uint64_t tile_rows[2][GB_GPU_TILES][2][8];
+    uint32_t tile_dirty[2][GB_GPU_TILES / 32];
+
     union {
         uint8_t mem[0xA0];
         uint8_t s_attrs[40][4]; /* Sprite attributes */
     } oam;
 
+    /* The sprites on each line, in OAM order, up to the limit of 10 per line.
+     * Built again before the next line is drawn once 'sprites_dirty' is set,
+     * by a write to OAM or a change in the sprite size. */
+    uint8_t line_sprites[GB_SCREEN_HEIGHT][GB_GPU_LINE_SPRITES];
+    uint8_t line_sprite_count[GB_SCREEN_HEIGHT];
+    int sprites_dirty;
+
     int cgb_bkgd_palette_index;
     uint8_t cgb_bkgd_palette[64];
 
     int cgb_sprite_palette_index;
     uint8_t cgb_sprite_palette[64];
 
+    /* Every GB_GPU_INDEX() value in each of the formats it is looked up in.
+     * Rebuilt before the next line is drawn once 'palettes_dirty' is set. */
+    union gb_gpu_color_u palette_colors[GB_GPU_INDEXES];
+    uint16_t palette_rgb565[GB_GPU_INDEXES];
+    uint8_t palette_shade[GB_GPU_INDEXES];
+    int palettes_dirty;
+
     uint8_t bkgd_line_colors[GB_SCREEN_WIDTH]; /* Temporary buffer holding current background colors */
     uint8_t bkgd_priority[GB_SCREEN_WIDTH]; /* 1 bit indicates BG/window priority */
 
     struct gb_gpu_display *display;
+
+#ifdef CONFIG_RENDER_THREAD
+    /* The thread the lines are drawn on, or NULL to draw them as they're
+     * reached. 'render_pending' is the number of lines queued for it that it
+     * hasn't finished yet. */
+    struct gb_render_thread *render_thread;
+    unsigned int render_pending;
+#endif
 };
 
+#ifdef CONFIG_RENDER_THREAD
+void gb_render_thread_wait(struct gb_render_thread *);
+#endif
+
+/* Waits for the render thread to finish every line queued so far. Has to be
+ * called before changing anything lines are drawn from apart from the
+ * registers in gb_gpu_line_regs - VRAM, OAM, the palettes, and the screen
+ * itself - or reading the screen. */
+static inline void gb_gpu_render_sync(struct gb_gpu *gpu)
+{
+#ifdef CONFIG_RENDER_THREAD
+    if (__atomic_load_n(&gpu->render_pending, __ATOMIC_ACQUIRE))
+        gb_render_thread_wait(gpu->render_thread);
+#endif
+}
+
+/* Has to be called for every write to VRAM that doesn't go through
+ * gb_gpu_vram_write8(), with 'addr' relative to the start of VRAM. The write
+ * itself has to come after a gb_gpu_render_sync(). */
+static inline void gb_gpu_vram_touch(struct gb_gpu *gpu, int bank, uint16_t addr)
+{
+    int tile = addr / 16;
+
+    if (tile < GB_GPU_TILES)
+        gpu->tile_dirty[bank][tile / 32] |= 1u << (tile % 32);
+}
+
+static inline void gb_gpu_vram_touch_range(struct gb_gpu *gpu, int bank, uint16_t addr, int len)
+{
+    int tile;
+
+    for (tile = addr / 16; tile <= (addr + len - 1) / 16 && tile < GB_GPU_TILES; tile++)
+        gpu->tile_dirty[bank][tile / 32] |= 1u << (tile % 32);
+}
+
+/* Has to be called whenever anything the palette colors are made from
+ * changes - the palette registers, the DMG theme, or 'cgb_real_colors' */
+static inline void gb_gpu_palettes_flush(struct gb_gpu *gpu)
+{
+    gpu->palettes_dirty = 1;
+}
+
 void gb_emu_gpu_tick(struct gb_emu *, int cycles);
+int gb_gpu_event_cycles(struct gb_gpu *);
 
 void gb_gpu_init(struct gb_gpu *);
+void gb_gpu_set_format(struct gb_gpu *, enum gb_gpu_format format);
 void gb_gpu_display_screen(struct gb_emu *emu, struct gb_gpu *gpu);
+void gb_gpu_render_line_regs(struct gb_emu *emu, struct gb_gpu *gpu, const struct gb_gpu_line_regs *regs);
+
+static inline int gb_gpu_line_is_dirty(const uint32_t *dirty_lines, int line)
+{
+    return !dirty_lines || ((dirty_lines[line / 32] >> (line % 32)) & 1);
+}
+
+/* The screen in 'gpu->format', as it's given to the display */
+static inline void *gb_gpu_screen(struct gb_gpu *gpu)
+{
+    if (gpu->format == GB_GPU_FORMAT_INDEX8)
+        return gpu->screen_index;
+
+    return gpu->screenbuf;
+}
+
+/* Has to be called when the display shows something other then the screen,
+ * so that all of it is displayed again next time */
+static inline void gb_gpu_mark_all_dirty(struct gb_gpu *gpu)
+{
+    int i;
+
+    for (i = 0; i < GB_GPU_DIRTY_WORDS; i++)
+        gpu->dirty_lines[i] = 0xFFFFFFFF;
+}
+
+/* Makes sure the next frame is drawn and displayed, whatever the frame skip */
+static inline void gb_gpu_show_next_frame(struct gb_gpu *gpu)
+{
+    gpu->skip_frame = 0;
+    gpu->frames_skipped = 0;
+}
 void gb_gpu_ctl_change(struct gb_emu *emu, struct gb_gpu *gpu, uint8_t new_ctl);
 void gb_gpu_dma(struct gb_emu *emu, uint8_t dma_addr);
 void gb_gpu_update_key_line(struct gb_emu *emu);
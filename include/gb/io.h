@@ -1,14 +1,38 @@
 #ifndef INCLUDE_GB_IO_H
 #define INCLUDE_GB_IO_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct gb_emu;
 
 #define GB_IO_BIOS_FLAG 0xFF50
 
+/* The I/O registers at 0xFF00 - 0xFF7F */
+#define GB_IO_REG_COUNT 0x80
+
+/*
+ * How one I/O register is read and written. 'reg' is the offset from 0xFF00.
+ *
+ * Plain registers, which are just stored, have 'offset' set to where they are
+ * in the gb_emu, and are read or written straight through it when 'read8' or
+ * 'write8' is NULL. Registers with neither read as 0xFF and ignore writes.
+ */
+struct gb_io_reg {
+    uint8_t (*read8) (struct gb_emu *, uint8_t reg);
+    void (*write8) (struct gb_emu *, uint8_t reg, uint8_t byte);
+
+    size_t offset;
+};
+
+struct gb_io {
+    struct gb_io_reg regs[GB_IO_REG_COUNT];
+};
+
 void gb_emu_io_reset(struct gb_emu *emu);
 uint8_t gb_emu_io_read8(struct gb_emu *, uint16_t addr, uint16_t low);
 void gb_emu_io_write8(struct gb_emu *, uint16_t addr, uint16_t low, uint8_t byte);
 
+void gb_emu_hdma_copy(struct gb_emu *emu, int len);
+
 #endif
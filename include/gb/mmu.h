@@ -5,6 +5,10 @@
 #include <stdio.h>
 #include <sys/time.h>
 
+#ifdef CONFIG_FASTMEM
+# include "gb/fastmem.h"
+#endif
+
 #define MAX_FILE_PACKET_NAME 19
 
 struct file_packet {
@@ -25,6 +29,11 @@ struct gb_mmu_entry {
     void (*write8) (struct gb_emu *, uint16_t addr, uint16_t low, uint8_t val);
 
     int (*get_bank) (struct gb_emu *, uint16_t addr);
+
+    /* Optional - Returns the memory backing the 256 byte page starting at
+     * 'addr', or NULL if it can't be read directly. The pointer stays valid
+     * until gb_mmu_fetch_flush() is called. */
+    const uint8_t *(*get_page) (struct gb_emu *, uint16_t addr, uint16_t low);
 };
 
 extern struct gb_mmu_entry gb_mbc0_mmu_entry, gb_mbc0_eram_mmu_entry;
@@ -112,15 +121,45 @@ struct gb_mmu {
     int hdma_active;
     int hdma_type;
     int hdma_length_left;
+
+    /* If set, every write marks the 256 byte page it hits - used to find
+     * what memory changed when verifying the JIT */
+    uint8_t *dirty_pages;
+
+    /* The page code was last fetched from, read directly when possible. See
+     * gb_emu_next_pc8() */
+    const uint8_t *fetch_ptr;
+    uint8_t fetch_page;
+
+#ifdef CONFIG_FASTMEM
+    struct gb_fastmem fastmem;
+#endif
 };
 
 void gb_mmu_add_mmu_entry(struct gb_mmu *mmu, struct gb_mmu_entry *entry);
 
+/* Has to be called whenever the memory mapped anywhere we fetch code from
+ * directly might change - bank switches, and the BIOS being unmapped */
+static inline void gb_mmu_fetch_flush(struct gb_mmu *mmu)
+{
+    mmu->fetch_ptr = NULL;
+
+#ifdef CONFIG_FASTMEM
+    gb_fastmem_invalidate(&mmu->fastmem);
+#endif
+}
+
+const uint8_t *gb_mmu_rom_page(struct gb_emu *, int data_offset);
+const uint8_t *gb_mmu_read_ptr(struct gb_emu *, uint16_t addr);
+
 /* Returns the current byte that the PC reg points too, and increments the PC
  * register by one */
 uint8_t gb_emu_next_pc8(struct gb_emu *);
 uint16_t gb_emu_next_pc16(struct gb_emu *);
 
+/* Returns the byte PC points too without moving it */
+uint8_t gb_emu_peek_pc8(struct gb_emu *);
+
 uint8_t gb_emu_read8(struct gb_emu *, uint16_t addr);
 void gb_emu_write8(struct gb_emu *, uint16_t addr, uint8_t byte);
 
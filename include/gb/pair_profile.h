@@ -0,0 +1,32 @@
+#ifndef INCLUDE_GB_PAIR_PROFILE_H
+#define INCLUDE_GB_PAIR_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "gb.h"
+
+/* How many pairs gb_pair_profile_print() displays */
+#define GB_PAIR_PROFILE_TOP 20
+
+/* Counts how often each opcode is run directly after each other opcode,
+ * through the CPU hooks */
+struct gb_pair_profile {
+    struct gb_cpu_hooks hooks;
+
+    /* The PC after the last instruction, used to skip over interrupts */
+    uint16_t end_pc;
+    int last_opcode;
+
+    /* The last instruction seen for each opcode, for the disassembly */
+    uint8_t last_inst[256][3];
+
+    uint64_t total;
+    uint64_t counts[256][256];
+};
+
+struct gb_pair_profile *gb_pair_profile_start(struct gb_emu *emu);
+void gb_pair_profile_print(struct gb_pair_profile *profile, FILE *file);
+void gb_pair_profile_stop(struct gb_emu *emu, struct gb_pair_profile *profile);
+
+#endif
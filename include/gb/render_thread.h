@@ -0,0 +1,39 @@
+#ifndef INCLUDE_GB_RENDER_THREAD_H
+#define INCLUDE_GB_RENDER_THREAD_H
+
+#include <pthread.h>
+
+#include "gb/gpu.h"
+
+struct gb_emu;
+
+/*
+ * A thread that draws the lines of the screen while the CPU carries on. Each
+ * line is queued with the registers it's drawn with when the GPU reaches it.
+ * Everything else it's drawn from is only changed after a
+ * gb_gpu_render_sync(), so the screen comes out the same as drawing the
+ * lines as they're reached.
+ *
+ * Lines are never queued past the end of a frame, since the screen is synced
+ * before it's displayed, so the queue only has to hold a frame's worth.
+ */
+struct gb_render_thread {
+    struct gb_emu *emu;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t done;
+
+    struct gb_gpu_line_regs lines[GB_SCREEN_HEIGHT];
+    unsigned int head, tail;
+
+    int exit;
+};
+
+int gb_render_thread_start(struct gb_emu *emu);
+void gb_render_thread_stop(struct gb_emu *emu);
+
+void gb_render_thread_queue(struct gb_render_thread *, const struct gb_gpu_line_regs *regs);
+
+#endif
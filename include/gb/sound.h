@@ -35,6 +35,10 @@ struct gb_sound {
 
     int16_t apu_sample_buffer[GB_APU_SAMPLES];
     unsigned int apu_cycles;
+
+    /* When set, the sound registers act like there is no APU - reads return
+     * zero and writes are dropped. */
+    int disabled;
 };
 
 void gb_sound_init(struct gb_sound *);
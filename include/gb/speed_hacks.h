@@ -0,0 +1,52 @@
+#ifndef INCLUDE_GB_SPEED_HACKS_H
+#define INCLUDE_GB_SPEED_HACKS_H
+
+#include <stdint.h>
+
+struct gb_rom;
+
+#define GB_SPEED_HACKS_MAX 32
+
+/* The longest wait loop gb_speed_hacks_is_wait_loop() recognizes */
+#define GB_SPEED_HACKS_LOOP_LEN 7
+
+enum gb_speed_hack_type {
+    /* A loop that only waits for an interrupt, or for LY or STAT to change */
+    GB_HACK_IDLE,
+
+    /* Code run from RAM which never changes once it is there, and so can be
+     * compiled by the JIT */
+    GB_HACK_RAM_CODE,
+};
+
+struct gb_speed_hack {
+    enum gb_speed_hack_type type;
+
+    /* 'bank' only matters for addresses in the switchable ROM bank */
+    int bank;
+    uint16_t addr;
+
+    /* RAM code only */
+    uint16_t len;
+};
+
+struct gb_speed_hacks {
+    int count;
+    struct gb_speed_hack hacks[GB_SPEED_HACKS_MAX];
+
+    /* A bit for every address an idle hint starts at, in any bank, so the
+     * interpreter can rule out the rest without searching 'hacks' */
+    uint8_t idle_addrs[0x10000 / 8];
+};
+
+int gb_speed_hacks_load(struct gb_speed_hacks *hacks, const char *filename, struct gb_rom *rom);
+int gb_speed_hacks_is_wait_loop(const uint8_t *code);
+
+static inline int gb_speed_hacks_may_idle(const struct gb_speed_hacks *hacks, uint16_t addr)
+{
+    return hacks->idle_addrs[addr >> 3] & (1 << (addr & 7));
+}
+
+const struct gb_speed_hack *gb_speed_hacks_find(const struct gb_speed_hacks *hacks, enum gb_speed_hack_type type, uint16_t addr, int bank);
+
+#endif
@@ -26,5 +26,6 @@ struct gb_timer {
 
 void gb_timer_ticks(struct gb_emu *emu, int cycles);
 void gb_timer_update_tac(struct gb_emu *emu, uint8_t new_tac);
+int gb_timer_event_cycles(struct gb_timer *timer);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef INCLUDE_NULL_DRIVER_H
+#define INCLUDE_NULL_DRIVER_H
+
+#include <stdio.h>
+
+#include "gb/sound.h"
+#include "gb/gpu.h"
+
+/*
+ * The headless backend - nothing is displayed and no audio device is opened.
+ * The keys come from a movie file, and the hash of every displayed frame can
+ * be written out to compare runs against each other.
+ */
+struct gb_null_driver;
+
+struct gb_null_driver *gb_null_driver_new(void);
+void gb_null_driver_destroy(struct gb_null_driver *);
+
+/* Returns non-zero if the movie can't be read */
+int gb_null_driver_load_movie(struct gb_null_driver *, const char *filename);
+
+/* Fills in 'keys' with the keys the movie gives for 'frame', counted like
+ * gpu.frame_count */
+void gb_null_driver_movie_keys(struct gb_null_driver *, unsigned int frame, struct gb_keypad *keys);
+
+/* Writes "<frame> <hash>" for every frame displayed, 'f' is not closed */
+void gb_null_driver_set_hash_file(struct gb_null_driver *, FILE *f);
+
+/* Stops the emulator once 'frames' frames have run, 0 to never stop */
+void gb_null_driver_set_frame_limit(struct gb_null_driver *, unsigned int frames);
+
+struct gb_gpu_display *gb_null_driver_get_gb_gpu_display(struct gb_null_driver *);
+
+#endif